@@ -1,18 +1,69 @@
 #ifndef SIMPLE_CURL_H
 #define SIMPLE_CURL_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <coroutine>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <span>
+#include <stop_token>
 #include <string>
+#include <string_view>
 #include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <curl/curl.h>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+class SimpleCurlTransfer;
+#endif
+
+// receives response bodies chunk by chunk as curl hands them over
+class SimpleCurlSink
+{
+public:
+  virtual ~SimpleCurlSink(void) noexcept = default;
+
+  // before the first chunk of a transfer, content_length is -1 when unknown
+  virtual void begin(curl_off_t content_length) { (void)content_length; }
+
+  // false aborts the transfer with CURLE_WRITE_ERROR
+  virtual bool write(std::span<const std::byte> chunk) = 0;
+
+  // once the transfer is over, even if it failed or never produced a body
+  virtual void end(CURLcode result) noexcept { (void)result; }
+};
+
 class SimpleCurl
 {
 public:
   SimpleCurl(void) noexcept
     : m_handle(curl_easy_init()),
       m_headers (nullptr), // nullify needed
-      m_last_error(CURLE_OK)
+      m_last_error(CURLE_OK),
+      m_sink(nullptr),
+      m_sink_started(false)
     {  }
 
   ~SimpleCurl(void) noexcept
@@ -28,13 +79,24 @@ public:
     { return checkError(curl_easy_pause(m_handle, bitmask)); }
 
   bool perform(void) noexcept
-    { return checkError(curl_easy_perform(m_handle)); }
+  {
+    m_sink_started = false;
+    bool ok = checkError(curl_easy_perform(m_handle));
+    endSink();
+    return ok;
+  }
 
   bool recv(void* buffer, std::size_t bufferLength, std::size_t* n) noexcept
     { return checkError(curl_easy_recv(m_handle, buffer, bufferLength, n)); }
 
+  // restores default options, keeping live connections and the DNS and TLS session caches
   void reset(void) noexcept
-    { curl_easy_reset(m_handle); }
+  {
+    curl_easy_reset(m_handle);
+    m_sink = nullptr;
+    if(m_headers != nullptr) // no longer referenced by the handle
+      curl_slist_free_all(m_headers), m_headers = nullptr;
+  }
 
   bool send(const void* buffer, std::size_t bufferLength, std::size_t* n) noexcept
     { return checkError(curl_easy_send(m_handle, buffer, bufferLength, n)); }
@@ -75,6 +137,18 @@ public:
   bool setOpt(CURLoption option, const std::string& arg)
     { return setOpt(option, arg.c_str()); }
 
+#ifdef __linux__
+  // co_await from a coroutine running on a SimpleCurlExecutor, see SimpleCurlTransfer
+  SimpleCurlTransfer asyncPerform(std::stop_token stop = {});
+#endif
+
+  // replaces CURLOPT_WRITEFUNCTION, the sink must outlive the transfers using it
+  bool setSink(SimpleCurlSink& sink) noexcept
+  {
+    m_sink = &sink;
+    return setOpt(CURLOPT_WRITEFUNCTION, writeSink) && setOpt(CURLOPT_WRITEDATA, this);
+  }
+
 
   std::string escape(const std::string& string)
   {
@@ -96,12 +170,1275 @@ public:
   constexpr CURL* getHandle(void) noexcept { return m_handle; }
   constexpr CURLcode getLastError(void) noexcept { return m_last_error; }
 private:
+  friend class SimpleCurlMulti; // reports the result of transfers it completes
+  friend class SimpleCurlAwaitable;
+  friend class SimpleCurlExecutor;
   constexpr bool checkError(CURLcode code) noexcept
   { return (m_last_error = code, code == CURLE_OK); }
 
+  static std::size_t writeSink(char* data, std::size_t size, std::size_t nmemb, void* userp) noexcept
+  {
+    SimpleCurl& self = *static_cast<SimpleCurl*>(userp);
+    try
+    {
+      if(!self.m_sink_started)
+      {
+        curl_off_t length = -1;
+        curl_easy_getinfo(self.m_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        self.m_sink->begin(length);
+        self.m_sink_started = true;
+      }
+      if(self.m_sink->write(std::span<const std::byte>(reinterpret_cast<const std::byte*>(data), size * nmemb)))
+        return size * nmemb;
+    }
+    catch(...) { }
+    return 0; // anything short of the chunk size fails the transfer
+  }
+
+  void endSink(void) noexcept
+  {
+    if(m_sink != nullptr)
+      m_sink->end(m_last_error);
+  }
+
   CURL* m_handle;
   struct curl_slist* m_headers;
   CURLcode m_last_error;
+  SimpleCurlSink* m_sink;
+  bool m_sink_started;
+};
+
+// collects the body in memory, reserving up to max_hint bytes from Content-Length
+class SimpleCurlBufferSink : public SimpleCurlSink
+{
+public:
+  SimpleCurlBufferSink(std::size_t max_hint = 64 << 20) noexcept
+    : m_max_hint(max_hint)
+    {  }
+
+  void begin(curl_off_t content_length) override
+  {
+    if(content_length > 0)
+      m_data.reserve(m_data.size() + std::min<std::size_t>(content_length, m_max_hint));
+  }
+
+  bool write(std::span<const std::byte> chunk) override
+  {
+    m_data.insert(m_data.end(), chunk.begin(), chunk.end());
+    return true;
+  }
+
+  void clear(void) noexcept { m_data.clear(); }
+  std::span<const std::byte> data(void) const noexcept { return m_data; }
+  std::string_view view(void) const noexcept
+    { return std::string_view(reinterpret_cast<const char*>(m_data.data()), m_data.size()); }
+  std::vector<std::byte> take(void) noexcept { return std::exchange(m_data, {}); }
+private:
+  std::size_t m_max_hint;
+  std::vector<std::byte> m_data;
+};
+
+// writes into a caller owned buffer, failing the transfer once it would overflow
+class SimpleCurlFixedSink : public SimpleCurlSink
+{
+public:
+  SimpleCurlFixedSink(std::span<std::byte> buffer) noexcept
+    : m_buffer(buffer),
+      m_size(0),
+      m_truncated(false)
+    {  }
+
+  bool write(std::span<const std::byte> chunk) override
+  {
+    std::size_t count = std::min(chunk.size(), m_buffer.size() - m_size);
+    std::memcpy(m_buffer.data() + m_size, chunk.data(), count);
+    m_size += count;
+    m_truncated = count < chunk.size();
+    return !m_truncated;
+  }
+
+  void clear(void) noexcept { m_size = 0, m_truncated = false; }
+  std::span<std::byte> data(void) const noexcept { return m_buffer.first(m_size); }
+  std::size_t size(void) const noexcept { return m_size; }
+  bool truncated(void) const noexcept { return m_truncated; }
+private:
+  std::span<std::byte> m_buffer;
+  std::size_t m_size;
+  bool m_truncated;
+};
+
+// hands each chunk straight to a callback, returning false aborts the transfer
+class SimpleCurlCallbackSink : public SimpleCurlSink
+{
+public:
+  using Callback = std::function<bool(std::span<const std::byte> chunk)>;
+
+  SimpleCurlCallbackSink(Callback callback) noexcept
+    : m_callback(std::move(callback))
+    {  }
+
+  bool write(std::span<const std::byte> chunk) override
+    { return m_callback(chunk); }
+private:
+  Callback m_callback;
+};
+
+// hands the body to a consumer thread through a fixed size ring buffer
+// write() blocks while the ring is full, so drive it with perform() on its own thread
+// rather than from a SimpleCurlMulti shared with other transfers
+class SimpleCurlRingSink : public SimpleCurlSink
+{
+public:
+  SimpleCurlRingSink(std::size_t capacity = 1 << 20)
+    : m_ring(capacity),
+      m_head(0),
+      m_size(0),
+      m_ended(false),
+      m_closed(false),
+      m_result(CURLE_OK)
+    {  }
+
+  void begin(curl_off_t) override
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ended = false;
+    m_result = CURLE_OK;
+  }
+
+  bool write(std::span<const std::byte> chunk) override
+  {
+    while(!chunk.empty())
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_writable.wait(lock, [this] { return m_closed || m_size < m_ring.size(); });
+      if(m_closed)
+        return false;
+      std::size_t count = copyIn(chunk);
+      chunk = chunk.subspan(count);
+      lock.unlock();
+      m_readable.notify_one();
+    }
+    return true;
+  }
+
+  void end(CURLcode result) noexcept override
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_ended = true;
+      m_result = result;
+    }
+    m_readable.notify_all();
+  }
+
+  // blocks until data is available, 0 once the transfer has ended and the ring is drained
+  std::size_t read(std::span<std::byte> buffer)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_readable.wait(lock, [this] { return m_ended || m_size > 0; });
+    std::size_t count = copyOut(buffer);
+    lock.unlock();
+    m_writable.notify_one();
+    return count;
+  }
+
+  // called by the consumer to give up, the transfer then fails with CURLE_WRITE_ERROR
+  void close(void) noexcept
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed = true;
+    }
+    m_writable.notify_all();
+  }
+
+  CURLcode result(void) const noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_result;
+  }
+private:
+  // both copy at most up to the wrap point and the caller loops
+  std::size_t copyIn(std::span<const std::byte> chunk) noexcept
+  {
+    std::size_t tail = (m_head + m_size) % m_ring.size();
+    std::size_t count = std::min({ chunk.size(), m_ring.size() - m_size, m_ring.size() - tail });
+    std::memcpy(m_ring.data() + tail, chunk.data(), count);
+    m_size += count;
+    return count;
+  }
+
+  std::size_t copyOut(std::span<std::byte> buffer) noexcept
+  {
+    std::size_t total = 0;
+    while(total < buffer.size() && m_size > 0)
+    {
+      std::size_t count = std::min({ buffer.size() - total, m_size, m_ring.size() - m_head });
+      std::memcpy(buffer.data() + total, m_ring.data() + m_head, count);
+      m_head = (m_head + count) % m_ring.size();
+      m_size -= count;
+      total += count;
+    }
+    return total;
+  }
+
+  std::vector<std::byte> m_ring;
+  std::size_t m_head;
+  std::size_t m_size;
+  bool m_ended;
+  bool m_closed;
+  CURLcode m_result;
+  mutable std::mutex m_mutex;
+  std::condition_variable m_readable;
+  std::condition_variable m_writable;
+};
+
+#ifdef __linux__
+// writes the body to a file with pwrite, bypassing the page cache with O_DIRECT where
+// the filesystem allows it; O_DIRECT needs aligned blocks so chunks are staged in an
+// aligned buffer, without it they are written straight from curl's buffer
+class SimpleCurlFileSink : public SimpleCurlSink
+{
+public:
+  static constexpr std::size_t alignment = 4096;
+
+  SimpleCurlFileSink(const std::string& filename, bool direct = true, std::size_t buffer_size = 1 << 20) noexcept
+    : m_fd(-1),
+      m_direct(false),
+      m_buffer(nullptr, std::free),
+      m_buffer_size((buffer_size + alignment - 1) / alignment * alignment),
+      m_buffered(0),
+      m_offset(0),
+      m_errno(0)
+  {
+    if(direct)
+    {
+      m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+      m_buffer.reset(static_cast<std::byte*>(std::aligned_alloc(alignment, m_buffer_size)));
+      m_direct = m_fd >= 0 && m_buffer != nullptr;
+    }
+    if(!m_direct) // not supported here, e.g. tmpfs
+    {
+      if(m_fd >= 0)
+        ::close(m_fd);
+      m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if(m_fd < 0)
+      m_errno = errno;
+  }
+
+  ~SimpleCurlFileSink(void) noexcept
+  {
+    flush();
+    if(m_fd >= 0)
+      ::close(m_fd);
+  }
+
+  SimpleCurlFileSink(const SimpleCurlFileSink&) = delete;
+  SimpleCurlFileSink& operator=(const SimpleCurlFileSink&) = delete;
+
+  bool write(std::span<const std::byte> chunk) override
+  {
+    if(m_errno != 0)
+      return false;
+    if(!m_direct)
+      return writeAll(chunk.data(), chunk.size());
+
+    while(!chunk.empty())
+    {
+      std::size_t count = std::min(chunk.size(), m_buffer_size - m_buffered);
+      std::memcpy(m_buffer.get() + m_buffered, chunk.data(), count);
+      m_buffered += count;
+      chunk = chunk.subspan(count);
+      if(m_buffered == m_buffer_size)
+      {
+        if(!writeAll(m_buffer.get(), m_buffered))
+          return false;
+        m_buffered = 0;
+      }
+    }
+    return true;
+  }
+
+  void end(CURLcode) noexcept override { flush(); }
+
+  // writes out a partial block, which O_DIRECT can't take, through the page cache
+  bool flush(void) noexcept
+  {
+    if(!m_direct || m_buffered == 0 || m_errno != 0)
+      return m_errno == 0;
+    std::size_t whole = m_buffered / alignment * alignment;
+    std::size_t rest = m_buffered - whole;
+    if(whole != 0)
+    {
+      if(!writeAll(m_buffer.get(), whole))
+        return false;
+      std::memmove(m_buffer.get(), m_buffer.get() + whole, rest);
+      m_buffered = rest;
+    }
+    if(rest != 0)
+    {
+      fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+      bool ok = writeAll(m_buffer.get(), rest);
+      fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_DIRECT);
+      if(!ok)
+        return false;
+      m_buffered = 0;
+    }
+    return true;
+  }
+
+  bool isOpen(void) const noexcept { return m_fd >= 0; }
+  bool isDirect(void) const noexcept { return m_direct; }
+  off_t size(void) const noexcept { return m_offset + m_buffered; }
+  int getLastError(void) const noexcept { return m_errno; }
+private:
+  bool writeAll(const std::byte* data, std::size_t length) noexcept
+  {
+    while(length > 0)
+    {
+      ssize_t written = ::pwrite(m_fd, data, length, m_offset);
+      if(written < 0)
+      {
+        if(errno == EINTR)
+          continue;
+        m_errno = errno;
+        return false;
+      }
+      data += written, length -= written, m_offset += written;
+    }
+    return true;
+  }
+
+  int m_fd;
+  bool m_direct;
+  std::unique_ptr<std::byte, decltype(&std::free)> m_buffer;
+  std::size_t m_buffer_size;
+  std::size_t m_buffered;
+  off_t m_offset;
+  int m_errno;
+};
+#endif
+
+// shares caches between SimpleCurl handles, which may run on different threads
+// each kind of shared data has its own mutex so DNS lookups don't wait on TLS sessions
+// must outlive the handles attached to it
+class SimpleCurlShare
+{
+public:
+  SimpleCurlShare(void) noexcept
+    : m_handle(curl_share_init()),
+      m_last_error(CURLSHE_OK)
+  {
+    curl_share_setopt(m_handle, CURLSHOPT_LOCKFUNC, lock);
+    curl_share_setopt(m_handle, CURLSHOPT_UNLOCKFUNC, unlock);
+    curl_share_setopt(m_handle, CURLSHOPT_USERDATA, this);
+  }
+
+  ~SimpleCurlShare(void) noexcept
+    { curl_share_cleanup(m_handle); }
+
+  SimpleCurlShare(const SimpleCurlShare&) = delete;
+  SimpleCurlShare& operator=(const SimpleCurlShare&) = delete;
+
+  bool share(curl_lock_data data) noexcept
+    { return checkError(curl_share_setopt(m_handle, CURLSHOPT_SHARE, data)); }
+
+  bool unshare(curl_lock_data data) noexcept
+    { return checkError(curl_share_setopt(m_handle, CURLSHOPT_UNSHARE, data)); }
+
+  // the DNS cache and TLS sessions; cookies stay per handle
+  // connections are left out, curl doesn't support sharing them between concurrent
+  // threads, recycling handles through SimpleCurlPool keeps them warm instead
+  bool shareCaches(void) noexcept
+    { return share(CURL_LOCK_DATA_DNS) && share(CURL_LOCK_DATA_SSL_SESSION); }
+
+  // options are cleared by SimpleCurl::reset(), attach again afterwards
+  bool attach(SimpleCurl& handle) noexcept
+    { return handle.setOpt(CURLOPT_SHARE, m_handle); }
+
+  bool detach(SimpleCurl& handle) noexcept
+    { return handle.setOpt(CURLOPT_SHARE, static_cast<CURLSH*>(nullptr)); }
+
+  constexpr CURLSH* getHandle(void) noexcept { return m_handle; }
+  constexpr CURLSHcode getLastError(void) noexcept { return m_last_error; }
+private:
+  constexpr bool checkError(CURLSHcode code) noexcept
+  { return (m_last_error = code, code == CURLSHE_OK); }
+
+  // curl never asks for shared access in practice, so a plain mutex per data kind will do
+  static void lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr) noexcept
+    { static_cast<SimpleCurlShare*>(userptr)->m_locks[data].lock(); }
+
+  static void unlock(CURL*, curl_lock_data data, void* userptr) noexcept
+    { static_cast<SimpleCurlShare*>(userptr)->m_locks[data].unlock(); }
+
+  CURLSH* m_handle;
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> m_locks;
+  CURLSHcode m_last_error;
+};
+
+// recycles easy handles with reset() instead of destroying them, so their connections
+// and caches outlive a single request; safe to use from several threads
+// must outlive the handles it hands out
+class SimpleCurlPool
+{
+public:
+  // applied to every handle as it is acquired, after the share is attached
+  using Configure = std::function<void(SimpleCurl& handle)>;
+
+  struct Release
+  {
+    SimpleCurlPool* pool;
+    void operator()(SimpleCurl* handle) const noexcept { pool->release(handle); }
+  };
+
+  using Handle = std::unique_ptr<SimpleCurl, Release>;
+
+  SimpleCurlPool(std::size_t max_idle = 64, Configure configure = {}, SimpleCurlShare* share = nullptr)
+    : m_max_idle(max_idle),
+      m_configure(std::move(configure)),
+      m_share(share)
+    {  }
+
+  SimpleCurlPool(const SimpleCurlPool&) = delete;
+  SimpleCurlPool& operator=(const SimpleCurlPool&) = delete;
+
+  Handle acquire(void)
+  {
+    std::unique_ptr<SimpleCurl> handle;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(!m_idle.empty())
+        handle = std::move(m_idle.back()), m_idle.pop_back();
+    }
+    if(!handle)
+      handle = std::make_unique<SimpleCurl>();
+    if(m_share != nullptr)
+      m_share->attach(*handle);
+    if(m_configure)
+      m_configure(*handle);
+    return Handle(handle.release(), Release { this });
+  }
+
+  std::size_t idle(void) const noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_idle.size();
+  }
+
+  void clear(void) noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_idle.clear();
+  }
+private:
+  void release(SimpleCurl* released) noexcept
+  {
+    std::unique_ptr<SimpleCurl> handle(released);
+    handle->reset();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_idle.size() < m_max_idle)
+      m_idle.push_back(std::move(handle));
+  }
+
+  std::size_t m_max_idle;
+  Configure m_configure;
+  SimpleCurlShare* m_share;
+  mutable std::mutex m_mutex;
+  std::vector<std::unique_ptr<SimpleCurl>> m_idle;
+};
+
+#ifdef __linux__
+// runs many SimpleCurl transfers on one thread through curl_multi_socket_action
+// sockets are watched with epoll and curl's timeouts with a timerfd, so the cost of a
+// poll() depends on the sockets that are ready rather than on the transfers in flight
+// not thread safe, except for wakeup()
+class SimpleCurlMulti
+{
+public:
+  // called once the transfer is finished and removed, the handle may be added again
+  using Completion = std::function<void(SimpleCurl& handle, CURLcode result)>;
+
+  SimpleCurlMulti(void) noexcept
+    : m_handle(curl_multi_init()),
+      m_epoll(epoll_create1(EPOLL_CLOEXEC)),
+      m_timer(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      m_wakeup(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      m_running(0),
+      m_last_error(CURLM_OK)
+  {
+    curl_multi_setopt(m_handle, CURLMOPT_SOCKETFUNCTION, socketCallback);
+    curl_multi_setopt(m_handle, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(m_handle, CURLMOPT_TIMERFUNCTION, timerCallback);
+    curl_multi_setopt(m_handle, CURLMOPT_TIMERDATA, this);
+
+    for(int fd : { m_timer, m_wakeup })
+    {
+      epoll_event event = {};
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+  }
+
+  ~SimpleCurlMulti(void) noexcept
+  {
+    for(auto& transfer : m_transfers) // abandoned without completion
+      curl_multi_remove_handle(m_handle, transfer.first);
+    curl_multi_cleanup(m_handle);
+    close(m_wakeup);
+    close(m_timer);
+    close(m_epoll);
+  }
+
+  SimpleCurlMulti(const SimpleCurlMulti&) = delete;
+  SimpleCurlMulti& operator=(const SimpleCurlMulti&) = delete;
+
+  // the handle must stay alive until its completion runs or it is removed
+  bool add(SimpleCurl& handle, Completion done)
+  {
+    if(!checkError(curl_multi_add_handle(m_handle, handle.getHandle())))
+      return false;
+    handle.m_sink_started = false;
+    m_transfers[handle.getHandle()] = Transfer { &handle, std::move(done) };
+    return true;
+  }
+
+  // cancels a transfer without running its completion, its sink still sees the end
+  bool remove(SimpleCurl& handle) noexcept
+  {
+    if(m_transfers.erase(handle.getHandle()) != 0)
+    {
+      handle.m_last_error = CURLE_ABORTED_BY_CALLBACK;
+      handle.endSink();
+    }
+    return checkError(curl_multi_remove_handle(m_handle, handle.getHandle()));
+  }
+
+  // waits up to timeout_ms (-1 for no limit) for socket activity, curl timeouts or
+  // wakeup(), drives curl and runs completions; returns the transfers still in flight
+  std::size_t poll(int timeout_ms = -1)
+  {
+    epoll_event events[max_events];
+    int count = epoll_wait(m_epoll, events, max_events, timeout_ms);
+    for(int i = 0; i < count; ++i)
+    {
+      int fd = events[i].data.fd;
+      if(fd == m_timer || fd == m_wakeup)
+      {
+        uint64_t expirations = 0;
+        if(read(fd, &expirations, sizeof(expirations)) > 0 && fd == m_timer)
+          checkError(curl_multi_socket_action(m_handle, CURL_SOCKET_TIMEOUT, 0, &m_running));
+      }
+      else
+      {
+        int flags = 0;
+        if(events[i].events & EPOLLIN)
+          flags |= CURL_CSELECT_IN;
+        if(events[i].events & EPOLLOUT)
+          flags |= CURL_CSELECT_OUT;
+        if(events[i].events & (EPOLLERR | EPOLLHUP))
+          flags |= CURL_CSELECT_ERR;
+        checkError(curl_multi_socket_action(m_handle, fd, flags, &m_running));
+      }
+    }
+    processCompletions();
+    return m_transfers.size();
+  }
+
+  // polls until every transfer, including ones added by completions, has finished
+  void run(void)
+  {
+    while(!m_transfers.empty())
+      poll();
+  }
+
+  // makes a blocked poll() return, safe to call from any thread
+  void wakeup(void) noexcept
+  {
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(m_wakeup, &one, sizeof(one));
+  }
+
+  std::size_t size(void) const noexcept { return m_transfers.size(); }
+
+  template <typename T>
+  bool setOpt(CURLMoption option, T arg)
+    { return checkError(curl_multi_setopt(m_handle, option, arg)); }
+
+  constexpr CURLM* getHandle(void) noexcept { return m_handle; }
+  constexpr CURLMcode getLastError(void) noexcept { return m_last_error; }
+private:
+  static constexpr int max_events = 256;
+
+  struct Transfer
+  {
+    SimpleCurl* handle;
+    Completion done;
+  };
+
+  constexpr bool checkError(CURLMcode code) noexcept
+  { return (m_last_error = code, code == CURLM_OK); }
+
+  // curl tells us which sockets to watch for what, socketp marks sockets already in epoll
+  static int socketCallback(CURL*, curl_socket_t socket, int what, void* userp, void* socketp) noexcept
+  {
+    SimpleCurlMulti& self = *static_cast<SimpleCurlMulti*>(userp);
+    if(what == CURL_POLL_REMOVE)
+    {
+      epoll_ctl(self.m_epoll, EPOLL_CTL_DEL, socket, nullptr);
+      return 0;
+    }
+
+    epoll_event event = {};
+    event.data.fd = socket;
+    if(what & CURL_POLL_IN)
+      event.events |= EPOLLIN;
+    if(what & CURL_POLL_OUT)
+      event.events |= EPOLLOUT;
+
+    if(socketp == nullptr)
+    {
+      epoll_ctl(self.m_epoll, EPOLL_CTL_ADD, socket, &event);
+      curl_multi_assign(self.m_handle, socket, &self);
+    }
+    else
+      epoll_ctl(self.m_epoll, EPOLL_CTL_MOD, socket, &event);
+    return 0;
+  }
+
+  // curl may not be re-entered from here, a zero timeout fires the timerfd right away
+  static int timerCallback(CURLM*, long timeout_ms, void* userp) noexcept
+  {
+    SimpleCurlMulti& self = *static_cast<SimpleCurlMulti*>(userp);
+    itimerspec timeout = {};
+    if(timeout_ms == 0)
+      timeout.it_value.tv_nsec = 1;
+    else if(timeout_ms > 0)
+    {
+      timeout.it_value.tv_sec = timeout_ms / 1000;
+      timeout.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    }
+    timerfd_settime(self.m_timer, 0, &timeout, nullptr); // all zero disarms
+    return 0;
+  }
+
+  void processCompletions(void)
+  {
+    int queued = 0;
+    while(CURLMsg* message = curl_multi_info_read(m_handle, &queued))
+    {
+      if(message->msg != CURLMSG_DONE)
+        continue;
+
+      CURL* easy = message->easy_handle;
+      CURLcode result = message->data.result;
+      curl_multi_remove_handle(m_handle, easy);
+
+      auto pos = m_transfers.find(easy);
+      if(pos == m_transfers.end())
+        continue;
+      Transfer transfer = std::move(pos->second);
+      m_transfers.erase(pos);
+
+      transfer.handle->m_last_error = result;
+      transfer.handle->endSink();
+      if(transfer.done)
+        transfer.done(*transfer.handle, result);
+    }
+  }
+
+  CURLM* m_handle;
+  int m_epoll;
+  int m_timer;
+  int m_wakeup;
+  int m_running;
+  std::unordered_map<CURL*, Transfer> m_transfers;
+  CURLMcode m_last_error;
+};
+
+class SimpleCurlExecutor;
+
+// common part of the awaitables below, the transfers run on a SimpleCurlExecutor's multi
+// handle and the awaiting coroutine resumes on that executor once all have finished
+// a stop request removes the transfers still running, which end with CURLE_ABORTED_BY_CALLBACK
+class SimpleCurlAwaitable
+{
+public:
+  SimpleCurlAwaitable(const SimpleCurlAwaitable&) = delete;
+  SimpleCurlAwaitable& operator=(const SimpleCurlAwaitable&) = delete;
+
+  bool await_ready(void) const noexcept { return m_handles.empty(); }
+  bool await_suspend(std::coroutine_handle<> waiter);
+protected:
+  SimpleCurlAwaitable(SimpleCurlExecutor* executor, std::vector<SimpleCurl*> handles, std::stop_token stop)
+    : m_executor(executor),
+      m_handles(std::move(handles)),
+      m_results(m_handles.size(), pending),
+      m_remaining(m_handles.size()),
+      m_id(0),
+      m_stop(std::move(stop))
+    {  }
+
+  std::vector<CURLcode>& results(void) noexcept { return m_results; }
+private:
+  friend class SimpleCurlExecutor;
+  static constexpr CURLcode pending = CURL_LAST;
+
+  // finishes the transfers that could not be started
+  void fail(CURLcode code) noexcept
+  {
+    for(std::size_t i = 0; i < m_handles.size(); ++i)
+      if(m_results[i] == pending)
+        m_results[i] = m_handles[i]->m_last_error = code;
+  }
+
+  SimpleCurlExecutor* m_executor;
+  std::vector<SimpleCurl*> m_handles;
+  std::vector<CURLcode> m_results;
+  std::size_t m_remaining;
+  uint64_t m_id;
+  std::coroutine_handle<> m_waiter;
+  std::stop_token m_stop;
+  std::optional<std::stop_callback<std::function<void()>>> m_on_stop;
+};
+
+// co_await yields the same as SimpleCurl::perform(), the result is in getLastError()
+class SimpleCurlTransfer : public SimpleCurlAwaitable
+{
+public:
+  SimpleCurlTransfer(SimpleCurlExecutor* executor, SimpleCurl& handle, std::stop_token stop = {})
+    : SimpleCurlAwaitable(executor, { &handle }, std::move(stop))
+    {  }
+
+  bool await_resume(void) noexcept { return results().front() == CURLE_OK; }
+};
+
+// runs several transfers at once, co_await yields their results in the order given
+class SimpleCurlBatch : public SimpleCurlAwaitable
+{
+public:
+  // on the executor running the awaiting coroutine
+  SimpleCurlBatch(std::vector<SimpleCurl*> handles, std::stop_token stop = {});
+
+  std::vector<CURLcode> await_resume(void) noexcept { return std::move(results()); }
+};
+
+// lazily started coroutine, runs when awaited or handed to SimpleCurlExecutor::spawn()
+template <typename T = void>
+class SimpleCurlTask
+{
+  struct promise_base
+  {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend(void) noexcept { return {}; }
+    void unhandled_exception(void) noexcept { error = std::current_exception(); }
+
+    // resumes whoever awaited the task without growing the stack
+    struct final_awaiter
+    {
+      bool await_ready(void) noexcept { return false; }
+      template <typename P>
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<P> task) noexcept
+      {
+        std::coroutine_handle<> continuation = task.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+      }
+      void await_resume(void) noexcept { }
+    };
+    final_awaiter final_suspend(void) noexcept { return {}; }
+
+    void rethrow(void)
+    {
+      if(error)
+        std::rethrow_exception(error);
+    }
+  };
+
+  struct promise_value : promise_base
+  {
+    std::optional<T> value;
+
+    template <typename U>
+    void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+    T result(void) { this->rethrow(); return std::move(*value); }
+  };
+
+  struct promise_void : promise_base
+  {
+    void return_void(void) noexcept { }
+    void result(void) { this->rethrow(); }
+  };
+public:
+  struct promise_type : std::conditional_t<std::is_void_v<T>, promise_void, promise_value>
+  {
+    SimpleCurlTask get_return_object(void) noexcept
+      { return SimpleCurlTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+  };
+
+  SimpleCurlTask(SimpleCurlTask&& other) noexcept
+    : m_coroutine(std::exchange(other.m_coroutine, nullptr))
+    {  }
+
+  SimpleCurlTask& operator=(SimpleCurlTask&& other) noexcept
+  {
+    if(this != &other)
+    {
+      if(m_coroutine)
+        m_coroutine.destroy();
+      m_coroutine = std::exchange(other.m_coroutine, nullptr);
+    }
+    return *this;
+  }
+
+  ~SimpleCurlTask(void) noexcept
+  {
+    if(m_coroutine)
+      m_coroutine.destroy();
+  }
+
+  auto operator co_await(void) noexcept
+  {
+    struct awaiter
+    {
+      std::coroutine_handle<promise_type> coroutine;
+
+      bool await_ready(void) noexcept { return !coroutine || coroutine.done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiter) noexcept
+      {
+        coroutine.promise().continuation = waiter;
+        return coroutine;
+      }
+      T await_resume(void) { return coroutine.promise().result(); }
+    };
+    return awaiter { m_coroutine };
+  }
+private:
+  explicit SimpleCurlTask(std::coroutine_handle<promise_type> coroutine) noexcept
+    : m_coroutine(coroutine)
+    {  }
+
+  std::coroutine_handle<promise_type> m_coroutine;
+};
+
+// drives coroutines and their transfers on the thread calling run()
+// run several executors, one per thread, to spread transfers over a few threads
+// post() and stop() may be called from any thread, everything else from the running one
+class SimpleCurlExecutor
+{
+public:
+  SimpleCurlExecutor(void) noexcept
+    : m_tasks(0),
+      m_next_id(0),
+      m_stopped(false)
+    {  }
+
+  SimpleCurlExecutor(const SimpleCurlExecutor&) = delete;
+  SimpleCurlExecutor& operator=(const SimpleCurlExecutor&) = delete;
+
+  // the executor running on this thread, if any
+  static SimpleCurlExecutor* current(void) noexcept { return currentSlot(); }
+
+  // starts the task on the next turn of the loop, run() rethrows the first exception to escape a task
+  template <typename T>
+  void spawn(SimpleCurlTask<T> task)
+  {
+    ++m_tasks;
+    detach(std::move(task));
+  }
+
+  // the awaiting coroutine resumes on the next turn of the loop
+  auto yield(void) noexcept
+  {
+    struct awaiter
+    {
+      SimpleCurlExecutor* executor;
+
+      bool await_ready(void) noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> waiter) { executor->m_ready.push_back(waiter); }
+      void await_resume(void) noexcept { }
+    };
+    return awaiter { this };
+  }
+
+  void post(std::function<void()> function)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_post_mutex);
+      m_posted.push_back(std::move(function));
+    }
+    m_multi.wakeup();
+  }
+
+  // runs until every spawned task and transfer has finished or stop() is called
+  // a stop() before run() makes it return at once, the request is cleared when run() returns
+  void run(void)
+  {
+    SimpleCurlExecutor* previous = std::exchange(currentSlot(), this);
+    while(!m_stopped)
+    {
+      runPosted();
+      while(!m_ready.empty())
+      {
+        std::coroutine_handle<> coroutine = m_ready.front();
+        m_ready.pop_front();
+        coroutine.resume();
+      }
+      bool posted = hasPosted();
+      if(m_tasks == 0 && m_multi.size() == 0 && !posted)
+        break;
+      m_multi.poll(m_ready.empty() && !posted ? -1 : 0);
+    }
+    m_stopped = false;
+    currentSlot() = previous;
+    if(m_error)
+      std::rethrow_exception(std::exchange(m_error, nullptr));
+  }
+
+  void stop(void) noexcept
+  {
+    m_stopped = true;
+    m_multi.wakeup();
+  }
+
+  SimpleCurlMulti& multi(void) noexcept { return m_multi; }
+  std::size_t tasks(void) const noexcept { return m_tasks; }
+private:
+  friend class SimpleCurlAwaitable;
+
+  // owns the frame of a spawned task until it finishes
+  struct detached
+  {
+    struct promise_type
+    {
+      detached get_return_object(void) noexcept { return {}; }
+      std::suspend_never initial_suspend(void) noexcept { return {}; }
+      std::suspend_never final_suspend(void) noexcept { return {}; }
+      void return_void(void) noexcept { }
+      void unhandled_exception(void) noexcept { std::terminate(); }
+    };
+  };
+
+  template <typename T>
+  detached detach(SimpleCurlTask<T> task)
+  {
+    co_await yield();
+    try
+    {
+      co_await std::move(task);
+    }
+    catch(...)
+    {
+      if(!m_error)
+        m_error = std::current_exception();
+    }
+    --m_tasks;
+  }
+
+  static SimpleCurlExecutor*& currentSlot(void) noexcept
+  {
+    thread_local SimpleCurlExecutor* executor = nullptr;
+    return executor;
+  }
+
+  bool hasPosted(void)
+  {
+    std::lock_guard<std::mutex> lock(m_post_mutex);
+    return !m_posted.empty();
+  }
+
+  void runPosted(void)
+  {
+    std::vector<std::function<void()>> posted;
+    {
+      std::lock_guard<std::mutex> lock(m_post_mutex);
+      posted.swap(m_posted);
+    }
+    for(auto& function : posted)
+      function();
+  }
+
+  // false when nothing could be started and the awaiting coroutine should carry on
+  bool begin(SimpleCurlAwaitable& awaitable)
+  {
+    uint64_t id = ++m_next_id;
+    for(std::size_t i = 0; i < awaitable.m_handles.size(); ++i)
+      if(!m_multi.add(*awaitable.m_handles[i], [this, id, i](SimpleCurl&, CURLcode result) { finish(id, i, result); }))
+      {
+        awaitable.m_results[i] = awaitable.m_handles[i]->m_last_error = CURLE_FAILED_INIT;
+        --awaitable.m_remaining;
+      }
+    if(awaitable.m_remaining == 0)
+      return false;
+
+    awaitable.m_id = id;
+    m_waiting[id] = &awaitable;
+    if(awaitable.m_stop.stop_possible()) // the callback may run on any thread
+      awaitable.m_on_stop.emplace(awaitable.m_stop, [this, id] { post([this, id] { cancel(id); }); });
+    return true;
+  }
+
+  void finish(uint64_t id, std::size_t index, CURLcode result)
+  {
+    auto pos = m_waiting.find(id);
+    if(pos == m_waiting.end())
+      return;
+    SimpleCurlAwaitable& awaitable = *pos->second;
+    awaitable.m_results[index] = result;
+    if(--awaitable.m_remaining == 0)
+    {
+      m_waiting.erase(pos);
+      m_ready.push_back(awaitable.m_waiter);
+    }
+  }
+
+  // a no-op when the transfers finished before the request got here
+  void cancel(uint64_t id)
+  {
+    auto pos = m_waiting.find(id);
+    if(pos == m_waiting.end())
+      return;
+    SimpleCurlAwaitable& awaitable = *pos->second;
+    for(std::size_t i = 0; i < awaitable.m_handles.size(); ++i)
+      if(awaitable.m_results[i] == SimpleCurlAwaitable::pending)
+      {
+        m_multi.remove(*awaitable.m_handles[i]);
+        awaitable.m_results[i] = CURLE_ABORTED_BY_CALLBACK;
+      }
+    awaitable.m_remaining = 0;
+    m_waiting.erase(pos);
+    m_ready.push_back(awaitable.m_waiter);
+  }
+
+  SimpleCurlMulti m_multi;
+  std::deque<std::coroutine_handle<>> m_ready;
+  std::unordered_map<uint64_t, SimpleCurlAwaitable*> m_waiting;
+  std::size_t m_tasks;
+  uint64_t m_next_id;
+  std::exception_ptr m_error;
+  std::atomic<bool> m_stopped;
+  std::mutex m_post_mutex;
+  std::vector<std::function<void()>> m_posted;
+};
+
+struct SimpleCurlRequest
+{
+  std::string url;
+  int priority = 0; // higher goes first, equal priorities in the order given
+  std::function<void(SimpleCurl& handle)> configure = {}; // extra options, applied after the defaults
+};
+
+struct SimpleCurlResponse
+{
+  std::size_t index; // into the requests passed to SimpleCurlFetcher::fetch
+  CURLcode result;
+  long status;
+  std::vector<std::byte> body;
+};
+
+struct SimpleCurlFetchOptions
+{
+  bool multiplex = true; // HTTP/2 streams share a connection per host where the server allows it
+  long max_total_connections = 64;
+  long max_host_connections = 6;
+  long max_concurrent_streams = 100; // per multiplexed connection
+  std::size_t max_in_flight = 256; // transfers handed to curl at once
+  std::size_t max_host_in_flight = 64; // of those, per host
+};
+
+// fetches a list of URLs concurrently on one multi handle, delivering responses as they finish
+// requests are only handed to curl while under the in-flight caps, so curl's own FIFO
+// pending queue never reorders them and one slow host can't hold up the others
+class SimpleCurlFetcher
+{
+public:
+  using Callback = std::function<void(SimpleCurlResponse&& response)>;
+
+  SimpleCurlFetcher(SimpleCurlFetchOptions options = {}) noexcept
+    : m_options(options)
+  {
+    m_options.max_in_flight = std::max<std::size_t>(m_options.max_in_flight, 1);
+    m_options.max_host_in_flight = std::max<std::size_t>(m_options.max_host_in_flight, 1);
+    m_multi.setOpt(CURLMOPT_PIPELINING, m_options.multiplex ? long(CURLPIPE_MULTIPLEX) : long(CURLPIPE_NOTHING));
+    m_multi.setOpt(CURLMOPT_MAX_TOTAL_CONNECTIONS, m_options.max_total_connections);
+    m_multi.setOpt(CURLMOPT_MAX_HOST_CONNECTIONS, m_options.max_host_connections);
+    m_multi.setOpt(CURLMOPT_MAX_CONCURRENT_STREAMS, m_options.max_concurrent_streams);
+  }
+
+  SimpleCurlFetcher(const SimpleCurlFetcher&) = delete;
+  SimpleCurlFetcher& operator=(const SimpleCurlFetcher&) = delete;
+
+  // blocks until every request has finished, calling back in completion order
+  void fetch(const std::vector<SimpleCurlRequest>& requests, const Callback& callback)
+  {
+    std::vector<std::string> hosts(requests.size());
+    for(std::size_t i = 0; i < requests.size(); ++i)
+      hosts[i] = hostOf(requests[i].url);
+
+    std::priority_queue<Entry> queue;
+    for(std::size_t i = 0; i < requests.size(); ++i)
+      queue.push(Entry { requests[i].priority, i });
+
+    std::unordered_map<std::string, Host> host_state;
+    std::vector<std::unique_ptr<Slot>> slots;
+    std::vector<Slot*> idle;
+    std::size_t in_flight = 0;
+    std::vector<SimpleCurlResponse> finished;
+
+    auto complete = [&](Slot& slot, CURLcode result)
+    {
+      SimpleCurlResponse response { slot.index, result, 0, {} };
+      slot.handle.getInfo(CURLINFO_RESPONSE_CODE, &response.status);
+      response.body = slot.sink.take();
+      slot.active = false;
+      idle.push_back(&slot);
+      --in_flight;
+
+      Host& host = host_state[hosts[slot.index]];
+      --host.in_flight;
+      if(!host.parked.empty()) // its best waiting request competes again
+        queue.push(host.parked.top()), host.parked.pop();
+      finished.push_back(std::move(response));
+    };
+
+    auto start = [&](std::size_t index)
+    {
+      if(idle.empty())
+        slots.push_back(std::make_unique<Slot>()), idle.push_back(slots.back().get());
+      Slot& slot = *idle.back();
+      idle.pop_back();
+
+      slot.index = index;
+      slot.active = true;
+      slot.sink.clear();
+      slot.handle.reset();
+      slot.handle.setSink(slot.sink);
+      slot.handle.setOpt(CURLOPT_URL, requests[index].url);
+      if(m_options.multiplex)
+      {
+        slot.handle.setOpt(CURLOPT_HTTP_VERSION, long(CURL_HTTP_VERSION_2TLS));
+        slot.handle.setOpt(CURLOPT_PIPEWAIT, 1L); // rather wait for a stream than open a connection
+      }
+      if(requests[index].configure)
+        requests[index].configure(slot.handle);
+
+      ++in_flight;
+      ++host_state[hosts[index]].in_flight;
+      if(!m_multi.add(slot.handle, [&, pointer = &slot](SimpleCurl&, CURLcode result) { complete(*pointer, result); }))
+        complete(slot, CURLE_FAILED_INIT);
+    };
+
+    auto fill = [&]
+    {
+      while(in_flight < m_options.max_in_flight && !queue.empty())
+      {
+        Entry entry = queue.top();
+        queue.pop();
+        Host& host = host_state[hosts[entry.index]];
+        if(host.in_flight >= m_options.max_host_in_flight)
+          host.parked.push(entry);
+        else
+          start(entry.index);
+      }
+    };
+
+    try
+    {
+      fill();
+      while(in_flight > 0 || !finished.empty())
+      {
+        if(finished.empty())
+          m_multi.poll();
+        fill();
+        for(auto& response : std::exchange(finished, {}))
+          callback(std::move(response));
+      }
+    }
+    catch(...) // the slots are about to go away
+    {
+      for(auto& slot : slots)
+        if(slot->active)
+          m_multi.remove(slot->handle);
+      throw;
+    }
+  }
+
+  std::vector<SimpleCurlResponse> fetch(const std::vector<SimpleCurlRequest>& requests)
+  {
+    std::vector<SimpleCurlResponse> responses;
+    responses.reserve(requests.size());
+    fetch(requests, [&responses](SimpleCurlResponse&& response) { responses.push_back(std::move(response)); });
+    return responses;
+  }
+
+  SimpleCurlMulti& multi(void) noexcept { return m_multi; }
+private:
+  struct Entry
+  {
+    int priority;
+    std::size_t index;
+
+    // the top of the queue is the highest priority, then the lowest index
+    bool operator<(const Entry& other) const noexcept
+      { return priority != other.priority ? priority < other.priority : index > other.index; }
+  };
+
+  struct Host
+  {
+    std::size_t in_flight = 0;
+    std::priority_queue<Entry> parked; // waiting for one of this host's transfers to finish
+  };
+
+  struct Slot
+  {
+    SimpleCurl handle;
+    SimpleCurlBufferSink sink;
+    std::size_t index = 0;
+    bool active = false;
+  };
+
+  // scheme, host and port, what connections are pooled by
+  static std::string hostOf(const std::string& url)
+  {
+    std::string host;
+    CURLU* parsed = curl_url();
+    if(curl_url_set(parsed, CURLUPART_URL, url.c_str(), CURLU_GUESS_SCHEME) == CURLUE_OK)
+    {
+      for(CURLUPart part : { CURLUPART_SCHEME, CURLUPART_HOST, CURLUPART_PORT })
+      {
+        char* value = nullptr;
+        if(curl_url_get(parsed, part, &value, CURLU_DEFAULT_PORT) == CURLUE_OK)
+          host.append(value).push_back('|');
+        curl_free(value);
+      }
+    }
+    curl_url_cleanup(parsed);
+    return host;
+  }
+
+  SimpleCurlFetchOptions m_options;
+  SimpleCurlMulti m_multi;
 };
 
+inline bool SimpleCurlAwaitable::await_suspend(std::coroutine_handle<> waiter)
+{
+  if(m_executor == nullptr)
+    return fail(CURLE_FAILED_INIT), false;
+  if(m_stop.stop_requested())
+    return fail(CURLE_ABORTED_BY_CALLBACK), false;
+  m_waiter = waiter;
+  return m_executor->begin(*this);
+}
+
+inline SimpleCurlBatch::SimpleCurlBatch(std::vector<SimpleCurl*> handles, std::stop_token stop)
+  : SimpleCurlAwaitable(SimpleCurlExecutor::current(), std::move(handles), std::move(stop))
+  {  }
+
+inline SimpleCurlTransfer SimpleCurl::asyncPerform(std::stop_token stop)
+  { return SimpleCurlTransfer(SimpleCurlExecutor::current(), *this, std::move(stop)); }
+#endif
+
 #endif // SIMPLE_CURL_H
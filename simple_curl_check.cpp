@@ -0,0 +1,527 @@
+// Executable checks for the SimpleCurl transfer engines, sinks and helpers, run against
+// an HTTP/1.1 server on the loopback interface so no network access is needed. Linux only.
+//
+// build: g++ -std=c++20 -g -fsanitize=address,undefined simple_curl_check.cpp -lcurl -o simple_curl_check
+// usage: simple_curl_check, exits non-zero if any check fails
+
+#include "simple_curl.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+  int failures = 0;
+
+  void check(bool condition, const char* what)
+  {
+    if(!condition)
+    {
+      std::fprintf(stderr, "FAIL: %s\n", what);
+      ++failures;
+    }
+  }
+
+  // bodies are a repeating alphabet so a misplaced chunk shows
+  bool is_pattern(std::string_view body, std::size_t size)
+  {
+    if(body.size() != size)
+      return false;
+    for(std::size_t i = 0; i < size; ++i)
+      if(body[i] != char('a' + i % 26))
+        return false;
+    return true;
+  }
+
+  // answers GET /bytes/N with N pattern bytes and GET /slow/MS with "slow" after MS
+  // milliseconds, anything else with an empty 404; connections are kept alive
+  class loopback_server
+  {
+  public:
+    loopback_server(void)
+      : m_listener(::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)),
+        m_port(0),
+        m_stopping(false),
+        m_connections(0),
+        m_active(0),
+        m_max_active(0)
+    {
+      sockaddr_in address = {};
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socklen_t length = sizeof(address);
+      if(::bind(m_listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+         ::listen(m_listener, 64) != 0 ||
+         ::getsockname(m_listener, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+        throw std::string("loopback server: can't listen");
+      m_port = ntohs(address.sin_port);
+      m_acceptor = std::thread(&loopback_server::accept_loop, this);
+    }
+
+    ~loopback_server(void)
+    {
+      m_stopping = true;
+      ::shutdown(m_listener, SHUT_RDWR);
+      m_acceptor.join();
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(int client : m_clients)
+          ::shutdown(client, SHUT_RDWR);
+      }
+      for(std::thread& thread : m_threads)
+        thread.join();
+      for(int client : m_clients)
+        ::close(client);
+      ::close(m_listener);
+    }
+
+    loopback_server(const loopback_server&) = delete;
+    loopback_server& operator=(const loopback_server&) = delete;
+
+    std::string url(std::string_view path) const
+      { return "http://127.0.0.1:" + std::to_string(m_port) + std::string(path); }
+
+    int connections(void) const noexcept { return m_connections; }
+    int maxActive(void) const noexcept { return m_max_active; } // requests being answered at once
+
+  private:
+    void accept_loop(void)
+    {
+      for(;;)
+      {
+        int client = ::accept4(m_listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if(client < 0)
+        {
+          if(errno == EINTR && !m_stopping)
+            continue;
+          return;
+        }
+        ++m_connections;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_clients.push_back(client);
+        m_threads.emplace_back(&loopback_server::serve, this, client);
+      }
+    }
+
+    void serve(int client)
+    {
+      std::string pending;
+      char buffer[4096];
+      for(;;)
+      {
+        std::size_t end;
+        while((end = pending.find("\r\n\r\n")) == std::string::npos)
+        {
+          ssize_t count = ::recv(client, buffer, sizeof(buffer), 0);
+          if(count <= 0)
+            return;
+          pending.append(buffer, count);
+        }
+        std::string request = pending.substr(0, end);
+        pending.erase(0, end + 4);
+        if(!respond(client, request))
+          return;
+      }
+    }
+
+    bool respond(int client, std::string_view request)
+    {
+      std::string_view path = request.substr(0, request.find("\r\n"));
+      path.remove_prefix(std::min(path.size(), path.find(' ') + 1));
+      path = path.substr(0, path.find(' '));
+
+      int active = ++m_active;
+      for(int seen = m_max_active; active > seen && !m_max_active.compare_exchange_weak(seen, active); )
+        ;
+
+      std::string status = "200 OK";
+      std::string body;
+      if(path.starts_with("/bytes/"))
+      {
+        std::size_t size = std::stoul(std::string(path.substr(7)));
+        body.reserve(size);
+        for(std::size_t i = 0; i < size; ++i)
+          body.push_back(char('a' + i % 26));
+      }
+      else if(path.starts_with("/slow/"))
+      {
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::stoi(std::string(path.substr(6))));
+        while(std::chrono::steady_clock::now() < until && !m_stopping)
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        body = "slow";
+      }
+      else
+        status = "404 Not Found";
+
+      std::string response = "HTTP/1.1 " + status + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+      bool sent = true;
+      for(std::string_view rest = response; sent && !rest.empty(); )
+      {
+        ssize_t count = ::send(client, rest.data(), rest.size(), MSG_NOSIGNAL);
+        sent = count > 0;
+        if(sent)
+          rest.remove_prefix(count);
+      }
+      --m_active;
+      return sent;
+    }
+
+    int m_listener;
+    int m_port;
+    std::atomic<bool> m_stopping;
+    std::atomic<int> m_connections;
+    std::atomic<int> m_active;
+    std::atomic<int> m_max_active;
+    std::thread m_acceptor;
+    std::mutex m_mutex;
+    std::vector<int> m_clients;
+    std::vector<std::thread> m_threads;
+  };
+
+  // keeps the body and whatever end() reported
+  struct recording_sink : SimpleCurlSink
+  {
+    std::string body;
+    std::optional<CURLcode> ended;
+
+    bool write(std::span<const std::byte> chunk) override
+    {
+      body.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+      return true;
+    }
+    void end(CURLcode result) noexcept override { ended = result; }
+  };
+
+  // transfers run side by side on one thread, completions may add more, and a removed
+  // transfer ends its sink without running its completion
+  void check_multi(loopback_server& server)
+  {
+    SimpleCurlMulti multi;
+    std::vector<std::unique_ptr<SimpleCurl>> handles;
+    std::vector<std::unique_ptr<recording_sink>> sinks;
+    int completed = 0;
+    bool all_ok = true;
+    auto done = [&](SimpleCurl&, CURLcode result) { ++completed; all_ok &= result == CURLE_OK; };
+
+    for(int i = 0; i < 5; ++i)
+    {
+      handles.push_back(std::make_unique<SimpleCurl>());
+      sinks.push_back(std::make_unique<recording_sink>());
+      handles[i]->setOpt(CURLOPT_URL, server.url("/bytes/" + std::to_string(1000 * (i + 1))));
+      handles[i]->setSink(*sinks[i]);
+    }
+    multi.add(*handles[0], [&](SimpleCurl& handle, CURLcode result)
+      {
+        done(handle, result);
+        multi.add(*handles[4], done);
+      });
+    for(int i = 1; i < 4; ++i)
+      multi.add(*handles[i], done);
+    multi.run();
+
+    bool bodies = true;
+    for(int i = 0; i < 5; ++i)
+      bodies &= is_pattern(sinks[i]->body, 1000 * (i + 1)) && sinks[i]->ended == CURLE_OK;
+    check(completed == 5 && all_ok && multi.size() == 0, "multi: run finishes every transfer, including added ones");
+    check(bodies, "multi: bodies arrive whole and sinks see the end");
+
+    SimpleCurl slow;
+    recording_sink slow_sink;
+    bool slow_done = false;
+    slow.setOpt(CURLOPT_URL, server.url("/slow/5000"));
+    slow.setSink(slow_sink);
+    multi.add(slow, [&](SimpleCurl&, CURLcode) { slow_done = true; });
+    multi.poll(20);
+    check(multi.remove(slow) && multi.size() == 0 && !slow_done, "multi: remove skips the completion");
+    check(slow_sink.ended == CURLE_ABORTED_BY_CALLBACK, "multi: a removed transfer ends its sink");
+
+    slow.setOpt(CURLOPT_URL, server.url("/bytes/10"));
+    slow_sink.body.clear();
+    multi.add(slow, [&](SimpleCurl&, CURLcode result) { slow_done = result == CURLE_OK; });
+    multi.run();
+    check(slow_done && is_pattern(slow_sink.body, 10), "multi: a removed handle can be added again");
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread waker([&multi] { std::this_thread::sleep_for(std::chrono::milliseconds(20)); multi.wakeup(); });
+    multi.poll(-1);
+    waker.join();
+    check(std::chrono::steady_clock::now() - start < std::chrono::seconds(5), "multi: wakeup ends a blocked poll");
+  }
+
+  // pooled handles come back reset but configured again, keeping their connection, and
+  // handles sharing caches can run on several threads at once
+  void check_share_pool(loopback_server& server)
+  {
+    SimpleCurlShare share;
+    check(share.shareCaches(), "share: DNS and TLS session caches");
+
+    std::atomic<int> configured = 0; // the configure callback runs on every acquiring thread
+    SimpleCurlPool pool(1, [&](SimpleCurl& handle) { ++configured; handle.setOpt(CURLOPT_URL, server.url("/bytes/10")); }, &share);
+    SimpleCurl* first = nullptr;
+    {
+      SimpleCurlPool::Handle handle = pool.acquire();
+      recording_sink sink;
+      handle->setSink(sink);
+      check(handle->perform() && is_pattern(sink.body, 10), "pool: a configured handle performs");
+      first = handle.get();
+    }
+    check(pool.idle() == 1, "pool: a released handle is kept");
+
+    int connections = server.connections();
+    {
+      SimpleCurlPool::Handle handle = pool.acquire();
+      check(handle.get() == first && pool.idle() == 0 && configured == 2, "pool: a recycled handle is configured again");
+      recording_sink sink;
+      handle->setSink(sink);
+      long connects = -1;
+      check(handle->perform() && handle->getInfo(CURLINFO_NUM_CONNECTS, &connects) && connects == 0 &&
+            server.connections() == connections, "pool: a recycled handle reuses its connection");
+    }
+
+    {
+      SimpleCurlPool::Handle one = pool.acquire();
+      SimpleCurlPool::Handle two = pool.acquire();
+    }
+    check(pool.idle() == 1, "pool: idle handles are capped at max_idle");
+
+    std::atomic<int> succeeded = 0;
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t)
+      threads.emplace_back([&]
+        {
+          for(int i = 0; i < 10; ++i)
+          {
+            SimpleCurlPool::Handle handle = pool.acquire();
+            recording_sink sink;
+            handle->setSink(sink);
+            succeeded += handle->perform() && is_pattern(sink.body, 10);
+          }
+        });
+    for(std::thread& thread : threads)
+      thread.join();
+    check(succeeded == 40, "share: handles sharing caches run on several threads");
+  }
+
+  // every sink takes the body as it streams in and can refuse it, which fails the transfer
+  void check_sinks(loopback_server& server)
+  {
+    SimpleCurl handle;
+
+    SimpleCurlBufferSink buffer;
+    handle.setOpt(CURLOPT_URL, server.url("/bytes/100000"));
+    handle.setSink(buffer);
+    check(handle.perform() && is_pattern(buffer.view(), 100000), "buffer sink: collects the body");
+
+    std::array<std::byte, 100> storage;
+    SimpleCurlFixedSink fixed(storage);
+    handle.setOpt(CURLOPT_URL, server.url("/bytes/100"));
+    handle.setSink(fixed);
+    check(handle.perform() && !fixed.truncated() &&
+          is_pattern(std::string_view(reinterpret_cast<const char*>(fixed.data().data()), fixed.size()), 100), "fixed sink: a body that fits");
+    fixed.clear();
+    handle.setOpt(CURLOPT_URL, server.url("/bytes/101"));
+    check(!handle.perform() && handle.getLastError() == CURLE_WRITE_ERROR && fixed.truncated(), "fixed sink: overflow fails the transfer");
+
+    std::size_t chunks = 0;
+    SimpleCurlCallbackSink refusing([&chunks](std::span<const std::byte>) { return ++chunks < 2; });
+    handle.setOpt(CURLOPT_URL, server.url("/bytes/1000000"));
+    handle.setSink(refusing);
+    check(!handle.perform() && handle.getLastError() == CURLE_WRITE_ERROR && chunks == 2, "callback sink: false aborts the transfer");
+
+    SimpleCurlRingSink ring(4096);
+    handle.setSink(ring);
+    std::thread producer([&handle] { handle.perform(); });
+    std::string received;
+    std::array<std::byte, 1500> chunk; // not a divisor of the ring, so reads wrap around
+    while(std::size_t count = ring.read(chunk))
+      received.append(reinterpret_cast<const char*>(chunk.data()), count);
+    producer.join();
+    check(is_pattern(received, 1000000) && ring.result() == CURLE_OK, "ring sink: the consumer reads the whole body");
+
+    SimpleCurlRingSink closing(4096);
+    handle.setSink(closing);
+    producer = std::thread([&handle] { handle.perform(); });
+    check(closing.read(chunk) > 0, "ring sink: data before close");
+    closing.close();
+    producer.join();
+    check(handle.getLastError() == CURLE_WRITE_ERROR, "ring sink: close fails the transfer");
+
+    std::string path = (std::filesystem::temp_directory_path() / "simple_curl_check.bin").string();
+    {
+      SimpleCurlFileSink file(path);
+      handle.setOpt(CURLOPT_URL, server.url("/bytes/10000")); // not a multiple of the O_DIRECT block size
+      handle.setSink(file);
+      check(file.isOpen() && handle.perform() && file.size() == 10000, "file sink: writes the body");
+      handle.reset();
+    }
+    std::ifstream in(path, std::ios::binary);
+    check(is_pattern(std::string(std::istreambuf_iterator<char>(in), {}), 10000), "file sink: the file holds the body");
+    std::filesystem::remove(path);
+  }
+
+  SimpleCurlTask<std::string> get_body(std::string url)
+  {
+    SimpleCurl handle;
+    recording_sink sink;
+    handle.setOpt(CURLOPT_URL, url);
+    handle.setSink(sink);
+    if(!co_await handle.asyncPerform())
+      co_return std::string();
+    co_return std::move(sink.body);
+  }
+
+  SimpleCurlTask<> fetch_all(loopback_server& server, SimpleCurlExecutor& executor, int& finished)
+  {
+    check(SimpleCurlExecutor::current() == &executor, "executor: current() inside a task");
+    std::string body = co_await get_body(server.url("/bytes/500"));
+    check(is_pattern(body, 500), "executor: a nested task awaits a transfer");
+
+    SimpleCurl found, missing, refused;
+    recording_sink found_sink, missing_sink;
+    found.setOpt(CURLOPT_URL, server.url("/bytes/20"));
+    found.setSink(found_sink);
+    missing.setOpt(CURLOPT_URL, server.url("/missing"));
+    missing.setSink(missing_sink);
+    refused.setOpt(CURLOPT_URL, std::string("http://127.0.0.1:1/"));
+    refused.setSink(missing_sink);
+    std::vector<SimpleCurl*> handles { &found, &missing, &refused }; // gcc 12 can't keep an initializer list across co_await
+    std::vector<CURLcode> results = co_await SimpleCurlBatch(std::move(handles));
+    long status = 0;
+    missing.getInfo(CURLINFO_RESPONSE_CODE, &status);
+    check(results.size() == 3 && results[0] == CURLE_OK && results[1] == CURLE_OK && results[2] == CURLE_COULDNT_CONNECT &&
+          is_pattern(found_sink.body, 20) && status == 404, "executor: a batch yields results in the order given");
+    ++finished;
+  }
+
+  SimpleCurlTask<> cancellable(loopback_server& server, std::stop_token stop, CURLcode& result)
+  {
+    SimpleCurl handle;
+    recording_sink sink;
+    handle.setOpt(CURLOPT_URL, server.url("/slow/5000"));
+    handle.setSink(sink);
+    co_await handle.asyncPerform(stop);
+    result = handle.getLastError();
+  }
+
+  SimpleCurlTask<> failing(void)
+  {
+    co_await SimpleCurlExecutor::current()->yield();
+    throw std::string("task failed");
+  }
+
+  // tasks and their transfers run on the executor's thread, a stop token cancels a
+  // transfer, exceptions reach run(), and a stop() before run() isn't lost
+  void check_executor(loopback_server& server)
+  {
+    SimpleCurlExecutor executor;
+    int finished = 0;
+    CURLcode cancelled = CURLE_OK;
+    CURLcode stopped_early = CURLE_OK;
+    std::stop_source stop;
+    std::stop_source stopped;
+    stopped.request_stop();
+
+    executor.spawn(fetch_all(server, executor, finished));
+    executor.spawn(cancellable(server, stop.get_token(), cancelled));
+    executor.spawn(cancellable(server, stopped.get_token(), stopped_early));
+    auto start = std::chrono::steady_clock::now();
+    std::thread stopper([&stop] { std::this_thread::sleep_for(std::chrono::milliseconds(50)); stop.request_stop(); });
+    executor.run();
+    stopper.join();
+    check(finished == 1 && executor.tasks() == 0, "executor: run() returns once every task has finished");
+    check(cancelled == CURLE_ABORTED_BY_CALLBACK && std::chrono::steady_clock::now() - start < std::chrono::seconds(4),
+          "executor: a stop request from another thread cancels the transfer");
+    check(stopped_early == CURLE_ABORTED_BY_CALLBACK, "executor: a transfer isn't started after a stop request");
+
+    std::string what;
+    executor.spawn(failing());
+    try { executor.run(); }
+    catch(const std::string& error) { what = error; }
+    check(what == "task failed", "executor: run() rethrows an exception escaping a task");
+
+    int ran = 0;
+    executor.stop();
+    executor.post([&ran] { ++ran; });
+    executor.run();
+    check(ran == 0, "executor: a stop() before run() makes it return at once");
+    executor.run();
+    check(ran == 1, "executor: the stop request is cleared when run() returns");
+  }
+
+  // a host at its in-flight cap doesn't hold up other hosts, and with one transfer at a
+  // time requests start by priority, then in the order given
+  void check_fetcher(loopback_server& server)
+  {
+    loopback_server busy; // fresh, cancelled slow requests of earlier checks may still count on server
+    std::vector<SimpleCurlRequest> requests;
+    for(int i = 0; i < 6; ++i)
+      requests.push_back({ busy.url("/slow/100") });
+    requests.push_back({ server.url("/bytes/10") });
+    requests.push_back({ server.url("/missing") });
+
+    SimpleCurlFetcher limited({ .multiplex = false, .max_in_flight = 8, .max_host_in_flight = 2 });
+    std::vector<SimpleCurlResponse> responses = limited.fetch(requests);
+
+    std::vector<std::size_t> order;
+    bool whole = responses.size() == requests.size();
+    for(const SimpleCurlResponse& response : responses)
+    {
+      order.push_back(response.index);
+      std::string_view body(reinterpret_cast<const char*>(response.body.data()), response.body.size());
+      if(response.index < 6)
+        whole &= response.result == CURLE_OK && response.status == 200 && body == "slow";
+      else
+        whole &= response.result == CURLE_OK && (response.index == 6 ? response.status == 200 && is_pattern(body, 10) : response.status == 404);
+    }
+    check(whole, "fetcher: every request gets its response");
+    check(busy.maxActive() == 2, "fetcher: a host is kept at max_host_in_flight");
+    check(order.size() == 8 && std::find(order.begin(), order.begin() + 3, 6) != order.begin() + 3 &&
+          std::find(order.begin(), order.begin() + 3, 7) != order.begin() + 3, "fetcher: other hosts aren't held up by a busy one");
+
+    std::vector<SimpleCurlRequest> ranked;
+    for(int priority : { 0, 5, 1, 5 })
+      ranked.push_back({ server.url("/bytes/10"), priority });
+    SimpleCurlFetcher serial({ .max_in_flight = 1 });
+    order.clear();
+    serial.fetch(ranked, [&order](SimpleCurlResponse&& response) { order.push_back(response.index); });
+    check(order == std::vector<std::size_t> { 1, 3, 2, 0 }, "fetcher: higher priorities start first");
+  }
+}
+
+int main(void)
+{
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  {
+    loopback_server server;
+    check_multi(server);
+    check_share_pool(server);
+    check_sinks(server);
+    check_executor(server);
+    check_fetcher(server);
+  }
+  curl_global_cleanup();
+
+  if(failures == 0)
+    std::puts("all checks passed");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -154,9 +154,8 @@ namespace HTTPConnection
   {
     if (!connection)
       return 0;
-    connection->data.reserve(connection->data.size() + size * nmemb);
-    for(size_t pos = 0, end = size * nmemb; pos < end; ++pos, ++data)
-      connection->data.push_back(*data);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    connection->data.insert(connection->data.end(), bytes, bytes + size * nmemb); // grows geometrically
     return size * nmemb;
   }
 
@@ -1,42 +1,110 @@
 #include "simple_sqlite.h"
 
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
 #include <cstring>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <random>
 
 namespace sql
 {
+  constexpr std::size_t default_statement_cache_size = 16;
+  constexpr int default_deadline_granularity = 1000;
+
   db::db(void) noexcept
-    : m_db(nullptr)
+    : m_db(nullptr),
+      m_last_error(SQLITE_OK),
+      m_cache_capacity(default_statement_cache_size),
+      m_cache_stats{0, 0, 0},
+      m_timeout(0),
+      m_granularity(default_deadline_granularity),
+      m_progress_installed(false),
+      m_deadline_hit(false),
+      m_deadline_stats{0, 0, 0},
+      m_lock_wait_stats{}
   {
   }
 
   db::~db(void) noexcept
   {
-    while(!close()); // wait for sqlite3_close to finish
+    if(m_self != nullptr) // queries still out finalize their own statements
+      *m_self = nullptr;
+    close(); // sqlite3_close_v2 never fails with SQLITE_BUSY, it defers until statements are finalized
   }
 
   bool db::open(const std::string_view& filename) noexcept
   {
-    m_last_error = sqlite3_open_v2(filename.data(),
-                                   &m_db,
-                                   SQLITE_OPEN_READWRITE |
-                                   SQLITE_OPEN_CREATE |
-                                   SQLITE_OPEN_EXRESCODE
-                                   , NULL);
+    return open(filename,
+                SQLITE_OPEN_READWRITE |
+                SQLITE_OPEN_CREATE |
+                SQLITE_OPEN_EXRESCODE);
+  }
+
+  bool db::open(const std::string_view& filename, int flags) noexcept
+  {
+    m_last_error = sqlite3_open_v2(filename.data(), &m_db, flags, NULL);
     return m_last_error == SQLITE_OK;
   }
 
   bool db::close(void) noexcept
   {
+    clearStatementCache();
+    if(m_profiler != nullptr)
+      m_profiler->active_rows.clear();
     m_last_error = sqlite3_close_v2(m_db);
     if(m_last_error == SQLITE_OK)
       m_db = nullptr;
     return m_last_error == SQLITE_OK;
   }
 
+  // matches BEGIN [DEFERRED] [TRANSACTION] [;]
+  static bool is_deferred_begin(std::string_view sql_str) noexcept
+  {
+    const std::string_view words[] = { "BEGIN", "DEFERRED", "TRANSACTION" };
+    std::size_t next = 0;
+    for(;;)
+    {
+      while(!sql_str.empty() && (std::isspace(static_cast<unsigned char>(sql_str.front())) || sql_str.front() == ';'))
+        sql_str.remove_prefix(1);
+      if(sql_str.empty())
+        return next > 0;
+
+      std::size_t length = 0;
+      while(length < sql_str.size() && std::isalpha(static_cast<unsigned char>(sql_str[length])))
+        ++length;
+      std::string_view word = sql_str.substr(0, length);
+      while(next < std::size(words) &&
+            !std::equal(word.begin(), word.end(), words[next].begin(), words[next].end(),
+                        [](char a, char b) { return std::toupper(static_cast<unsigned char>(a)) == b; }))
+      {
+        if(next == 0) // BEGIN is required
+          return false;
+        ++next;
+      }
+      if(length == 0 || next == std::size(words))
+        return false;
+      ++next;
+      sql_str.remove_prefix(length);
+    }
+  }
+
   bool db::execute(const std::string_view& sql_str) noexcept
   {
     char* err = nullptr;
-    int rc = sqlite3_exec(m_db, sql_str.data(), NULL, NULL, &err);
+    bool timed = m_timeout.count() > 0;
+    bool immediate = m_busy_policy && m_busy_policy->immediate_transactions && is_deferred_begin(sql_str);
+    if(timed)
+      arm_deadline(std::chrono::steady_clock::now() + m_timeout);
+    int rc = sqlite3_exec(m_db, immediate ? "BEGIN IMMEDIATE" : sql_str.data(), NULL, NULL, &err);
+    if(timed)
+      rc = disarm_deadline(rc);
+    end_lock_wait();
+    m_last_error = rc;
     if(rc != SQLITE_OK)
     {
       sqlite3_free(err);
@@ -47,19 +115,440 @@ namespace sql
 
   query db::build_query(const std::string_view& query_str)
   {
-    sqlite3_stmt* statement = nullptr;
+    if(m_self == nullptr)
+      m_self = std::make_shared<db*>(this);
+
+    std::string key;
+    sqlite3_stmt* statement = checkout(query_str, key);
+    if(statement != nullptr)
+      return query(statement, m_self, std::move(key));
+
     int rval = sqlite3_prepare_v2(m_db, query_str.data(), query_str.size(), &statement, NULL);
     if(rval != SQLITE_OK)
       throw "build query: " + std::string(sqlite3_errstr(rval)).append("\ninput: ").append(query_str);
-    return query(statement);
+    return query(statement, m_self, std::string(query_str));
+  }
+
+  void db::setStatementCacheSize(std::size_t capacity) noexcept
+  {
+    m_cache_capacity = capacity;
+    while(m_cache.size() > m_cache_capacity)
+      evict(std::prev(m_cache.end()));
+  }
+
+  void db::clearStatementCache(void) noexcept
+  {
+    for(cached_statement& entry : m_cache)
+      sqlite3_finalize(entry.statement);
+    m_cache_index.clear();
+    m_cache.clear();
+  }
+
+  sqlite3_stmt* db::checkout(const std::string_view& query_str, std::string& key) noexcept
+  {
+    auto pos = m_cache_index.find(query_str);
+    if(pos == m_cache_index.end())
+    {
+      ++m_cache_stats.misses;
+      return nullptr;
+    }
+
+    ++m_cache_stats.hits;
+    cache_list::iterator entry = pos->second;
+    sqlite3_stmt* statement = entry->statement;
+    m_cache_index.erase(pos); // erase before the key storage goes away
+    key = std::move(entry->sql);
+    m_cache.erase(entry);
+    return statement;
+  }
+
+  void db::checkin(sqlite3_stmt* statement, std::string&& key) noexcept
+  {
+    // statements are reset when returned so they don't hold read locks while idle
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+
+    if(m_db == nullptr ||
+       sqlite3_db_handle(statement) != m_db || // connection was reopened
+       m_cache_capacity == 0 ||
+       m_cache_index.count(key)) // an identical statement is already idle
+    {
+      sqlite3_finalize(statement);
+      return;
+    }
+
+    m_cache.push_front({std::move(key), statement});
+    m_cache_index.emplace(m_cache.front().sql, m_cache.begin());
+
+    while(m_cache.size() > m_cache_capacity)
+      evict(std::prev(m_cache.end()));
+  }
+
+  void db::evict(cache_list::iterator pos) noexcept
+  {
+    ++m_cache_stats.evictions;
+    sqlite3_finalize(pos->statement);
+    m_cache_index.erase(pos->sql);
+    m_cache.erase(pos);
+  }
+
+  void db::setDeadlineGranularity(int instructions) noexcept
+  {
+    m_granularity = std::max(1, instructions);
+    if(m_progress_installed)
+      sqlite3_progress_handler(m_db, m_granularity, progress, this);
+  }
+
+  void db::arm_deadline(std::chrono::steady_clock::time_point deadline) noexcept
+  {
+    if(!m_progress_installed)
+    {
+      sqlite3_progress_handler(m_db, m_granularity, progress, this);
+      m_progress_installed = true;
+    }
+    m_deadline = deadline;
+    m_deadline_hit = false;
+    ++m_deadline_stats.armed;
+  }
+
+  int db::disarm_deadline(int rval) noexcept
+  {
+    m_deadline = std::chrono::steady_clock::time_point();
+    if(m_deadline_hit && (rval & 0xff) == SQLITE_INTERRUPT)
+    {
+      ++m_deadline_stats.timeouts;
+      return timed_out;
+    }
+    return rval;
+  }
+
+  int db::progress(void* context) noexcept
+  {
+    db& self = *static_cast<db*>(context);
+    ++self.m_deadline_stats.checks;
+    if(self.m_deadline == std::chrono::steady_clock::time_point() ||
+       std::chrono::steady_clock::now() < self.m_deadline)
+      return 0;
+    self.m_deadline_hit = true;
+    return 1; // interrupts the statement
+  }
+
+  void db::setBusyPolicy(const busy_policy& policy) noexcept
+  {
+    m_busy_policy = policy;
+    sqlite3_busy_handler(m_db, busy, this);
+  }
+
+  void db::clearBusyPolicy(void) noexcept
+  {
+    m_busy_policy.reset();
+    sqlite3_busy_handler(m_db, nullptr, nullptr);
+  }
+
+  // SQLite doesn't report when a lock is finally acquired, so a wait is closed
+  // once the step or exec that triggered it returns
+  void db::end_lock_wait(void) noexcept
+  {
+    if(m_wait_start == std::chrono::steady_clock::time_point())
+      return;
+
+    uint64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_wait_start).count();
+    m_wait_start = std::chrono::steady_clock::time_point();
+    ++m_lock_wait_stats.waits;
+    m_lock_wait_stats.total_ns += waited;
+    m_lock_wait_stats.max_ns = std::max(m_lock_wait_stats.max_ns, waited);
+    ++m_lock_wait_stats.histogram[std::min<std::size_t>(std::bit_width(waited / 1000), m_lock_wait_stats.histogram.size() - 1)];
+  }
+
+  int db::busy(void* context, int attempts) noexcept
+  {
+    db& self = *static_cast<db*>(context);
+    const busy_policy& policy = *self.m_busy_policy;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    if(attempts == 0)
+    {
+      self.end_lock_wait(); // a previous wait that was never closed
+      self.m_wait_start = now;
+    }
+
+    thread_local std::minstd_rand random(std::random_device {}());
+    double delay = double(policy.initial_delay.count()) * std::pow(policy.multiplier, std::min(attempts, 64));
+    delay = std::min(delay, double(policy.max_delay.count()));
+    delay *= 1.0 - policy.jitter * std::uniform_real_distribution<double>(0.0, 1.0)(random);
+
+    std::chrono::microseconds pause(static_cast<int64_t>(delay));
+    if(now + pause - self.m_wait_start > policy.max_wait)
+    {
+      ++self.m_lock_wait_stats.timeouts;
+      self.end_lock_wait();
+      return 0; // give up, the caller gets SQLITE_BUSY
+    }
+
+    ++self.m_lock_wait_stats.retries;
+    std::this_thread::sleep_for(pause);
+    return 1;
+  }
+
+  int db::copy_database(sqlite3* source, sqlite3* destination, const backup_options& options) noexcept
+  {
+    sqlite3_backup* backup = sqlite3_backup_init(destination, "main", source, "main");
+    if(backup == nullptr)
+      return sqlite3_extended_errcode(destination);
+
+    int rval = SQLITE_OK;
+    int pages = options.pages_per_step > 0 ? options.pages_per_step : -1;
+    std::chrono::steady_clock::duration waited {};
+    do
+    {
+      rval = sqlite3_backup_step(backup, pages);
+      if(options.progress &&
+         !options.progress(sqlite3_backup_remaining(backup), sqlite3_backup_pagecount(backup)))
+      {
+        sqlite3_backup_finish(backup);
+        return SQLITE_ABORT;
+      }
+
+      if(rval == SQLITE_BUSY || rval == SQLITE_LOCKED) // a writer holds the source, wait and retry
+      {
+        if(waited >= options.busy_timeout)
+        {
+          sqlite3_backup_finish(backup);
+          return rval;
+        }
+        std::chrono::steady_clock::time_point before = std::chrono::steady_clock::now();
+        sqlite3_sleep(std::max<int>(1, int(options.step_pause.count())));
+        waited += std::chrono::steady_clock::now() - before;
+      }
+      else if(rval == SQLITE_OK && options.step_pause.count() > 0)
+        sqlite3_sleep(int(options.step_pause.count()));
+    } while(rval == SQLITE_OK || rval == SQLITE_BUSY || rval == SQLITE_LOCKED);
+
+    int finished = sqlite3_backup_finish(backup);
+    return rval == SQLITE_DONE ? finished : rval;
+  }
+
+  bool db::snapshot_to(const std::string_view& filename, const backup_options& options) noexcept
+  {
+    db destination;
+    if(!destination.open(filename))
+    {
+      m_last_error = destination.lastError();
+      return false;
+    }
+    return snapshot_to(destination, options);
+  }
+
+  bool db::snapshot_to(db& destination, const backup_options& options) noexcept
+  {
+    m_last_error = copy_database(m_db, destination.m_db, options);
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool db::swap_in_memory(sqlite3* source, const backup_options& options) noexcept
+  {
+    sqlite3* memory = nullptr;
+    m_last_error = sqlite3_open_v2(":memory:", &memory,
+                                   SQLITE_OPEN_READWRITE |
+                                   SQLITE_OPEN_CREATE |
+                                   SQLITE_OPEN_EXRESCODE,
+                                   NULL);
+    if(m_last_error == SQLITE_OK)
+      m_last_error = copy_database(source, memory, options);
+
+    if(m_last_error != SQLITE_OK)
+    {
+      sqlite3_close_v2(memory);
+      return false;
+    }
+
+    clearStatementCache(); // cached statements belong to the old connection
+    if(m_profiler != nullptr)
+    {
+      m_profiler->active_rows.clear();
+      sqlite3_trace_v2(memory, SQLITE_TRACE_STMT | SQLITE_TRACE_ROW | SQLITE_TRACE_PROFILE, trace_event, this);
+    }
+
+    if(m_progress_installed)
+      sqlite3_progress_handler(memory, m_granularity, progress, this);
+    if(m_busy_policy)
+      sqlite3_busy_handler(memory, busy, this);
+
+    std::swap(m_db, memory);
+    sqlite3_close_v2(memory); // deferred until outstanding statements are finalized
+    return true;
+  }
+
+  bool db::load_into_memory(const backup_options& options) noexcept
+  {
+    return swap_in_memory(m_db, options);
+  }
+
+  bool db::load_into_memory(const std::string_view& filename, const backup_options& options) noexcept
+  {
+    db source;
+    if(!source.open(filename, SQLITE_OPEN_READONLY | SQLITE_OPEN_EXRESCODE))
+    {
+      m_last_error = source.lastError();
+      return false;
+    }
+    return swap_in_memory(source.m_db, options);
+  }
+
+  // literals are replaced so executions that only differ by their values share counters
+  static std::string normalize_sql(const char* sql)
+  {
+    std::string normalized;
+    bool identifier = false;
+    for(const char* pos = sql; *pos != '\0'; ++pos)
+    {
+      unsigned char ch = *pos;
+      if(ch == '\'') // string literal, '' is an escaped quote
+      {
+        while(*++pos != '\0' && (*pos != '\'' || *++pos == '\''));
+        normalized.push_back('?');
+        identifier = false;
+        if(*pos == '\0')
+          break;
+        ch = *pos;
+      }
+
+      if(std::isdigit(ch) && !identifier)
+      {
+        // a sign only continues the literal as an exponent, which hex literals don't have
+        bool hex = ch == '0' && (pos[1] == 'x' || pos[1] == 'X');
+        while(std::isalnum(static_cast<unsigned char>(pos[1])) || pos[1] == '.' ||
+              (!hex && (pos[1] == '+' || pos[1] == '-') && (pos[0] == 'e' || pos[0] == 'E')))
+          ++pos;
+        normalized.push_back('?');
+      }
+      else if((ch == '?' || ch == ':' || ch == '@' || ch == '$') && !identifier) // parameters are kept as written
+      {
+        normalized.push_back(char(ch));
+        while(std::isalnum(static_cast<unsigned char>(pos[1])) || pos[1] == '_')
+          normalized.push_back(*++pos);
+      }
+      else if(std::isspace(ch))
+      {
+        if(!normalized.empty() && normalized.back() != ' ')
+          normalized.push_back(' ');
+        identifier = false;
+      }
+      else
+      {
+        normalized.push_back(char(ch));
+        identifier = std::isalnum(ch) || ch == '_';
+      }
+    }
+
+    while(!normalized.empty() && normalized.back() == ' ')
+      normalized.pop_back();
+    return normalized;
+  }
+
+  bool db::enableProfiling(profile_callback callback) noexcept
+  {
+    if(m_profiler == nullptr)
+      m_profiler.reset(new(std::nothrow) profiler());
+    if(m_profiler == nullptr)
+      return false;
+
+    m_profiler->callback = std::move(callback);
+    m_last_error = sqlite3_trace_v2(m_db,
+                                    SQLITE_TRACE_STMT | SQLITE_TRACE_ROW | SQLITE_TRACE_PROFILE,
+                                    trace_event,
+                                    this);
+    return m_last_error == SQLITE_OK;
+  }
+
+  void db::disableProfiling(void) noexcept
+  {
+    sqlite3_trace_v2(m_db, 0, NULL, NULL);
+    m_profiler.reset();
+  }
+
+  void db::resetProfiling(void) noexcept
+  {
+    if(m_profiler != nullptr)
+      m_profiler->statements.clear();
+  }
+
+  std::vector<statement_profile> db::profileSnapshot(void) const
+  {
+    std::vector<statement_profile> snapshot;
+    if(m_profiler != nullptr)
+      for(const auto& entry : m_profiler->statements)
+        snapshot.push_back(entry.second);
+    return snapshot;
+  }
+
+  int db::trace_event(unsigned int event, void* context, void* subject, void* detail) noexcept
+  {
+    profiler& state = *static_cast<db*>(context)->m_profiler;
+    sqlite3_stmt* statement = static_cast<sqlite3_stmt*>(subject);
+
+    try
+    {
+      switch(event)
+      {
+        case SQLITE_TRACE_STMT:
+          state.active_rows[statement] = 0;
+          break;
+
+        case SQLITE_TRACE_ROW:
+          ++state.active_rows[statement];
+          break;
+
+        case SQLITE_TRACE_PROFILE:
+        {
+          auto rows = state.active_rows.find(statement);
+          std::string sql = normalize_sql(sqlite3_sql(statement));
+          statement_execution run =
+          {
+            sql,
+            uint64_t(*static_cast<sqlite3_int64*>(detail)),
+            rows == state.active_rows.end() ? 0 : rows->second,
+            uint64_t(sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_VM_STEP, 1)),
+            uint64_t(sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1)),
+            uint64_t(sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_SORT, 1)),
+            uint64_t(sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_AUTOINDEX, 1)),
+          };
+          if(rows != state.active_rows.end())
+            state.active_rows.erase(rows);
+
+          statement_profile& totals = state.statements[sql];
+          if(totals.calls++ == 0)
+            totals.sql = sql;
+          totals.rows += run.rows;
+          totals.total_ns += run.elapsed_ns;
+          totals.max_ns = std::max(totals.max_ns, run.elapsed_ns);
+          totals.vm_steps += run.vm_steps;
+          totals.fullscan_steps += run.fullscan_steps;
+          totals.sorts += run.sorts;
+          totals.autoindexes += run.autoindexes;
+          ++totals.latency_histogram[std::min<std::size_t>(std::bit_width(run.elapsed_ns / 1000), totals.latency_histogram.size() - 1)];
+
+          if(state.callback)
+            state.callback(run);
+          break;
+        }
+      }
+    }
+    catch(...) { } // never unwind through SQLite
+
+    return 0;
   }
 
-  query::query(sqlite3_stmt* statement)
+  query::query(sqlite3_stmt* statement, std::shared_ptr<db*> owner, std::string&& key)
     : m_statement(statement),
+      m_owner(std::move(owner)),
+      m_key(std::move(key)),
       m_last_error(SQLITE_OK),
       m_arg(0),
       m_field(0),
-      m_buffered_filled(false)
+      m_buffered_filled(false),
+      m_deadline(),
+      m_run_deadline()
   {
   }
 
@@ -71,30 +560,48 @@ namespace sql
 
   query::~query(void) noexcept
   {
-    if(valid())
-      m_last_error = sqlite3_finalize(m_statement);
+    release();
   }
 
   query& query::operator= (query&& other) noexcept
   {
-    if(valid())
-      m_last_error = sqlite3_finalize(m_statement);
+    release();
 
     m_statement = other.m_statement; other.m_statement = nullptr;
+    m_owner = std::move(other.m_owner);
+    m_key = std::move(other.m_key);
     m_last_error = other.m_last_error;
     m_arg = other.m_arg;
     m_field = other.m_field;
     m_buffered_filled = other.m_buffered_filled;
+    m_deadline = other.m_deadline;
+    m_run_deadline = other.m_run_deadline;
+    m_view_buffers = std::move(other.m_view_buffers);
     return *this;
   }
 
 
+  void query::release(void) noexcept
+  {
+    if(!valid())
+      return;
+
+    invalidate_views();
+    if(db* connection = owner())
+      connection->checkin(m_statement, std::move(m_key));
+    else
+      m_last_error = sqlite3_finalize(m_statement);
+    m_statement = nullptr;
+    m_owner.reset();
+  }
+
   bool query::execute(void) noexcept
   {
     if(!valid())
       return false;
 
-    m_last_error = sqlite3_step(m_statement);
+    invalidate_views();
+    m_last_error = step();
     if(m_last_error == SQLITE_ROW)
       m_buffered_filled = true;
 
@@ -109,14 +616,102 @@ namespace sql
       return false;
 
     m_field = 0; // reset fetches
+    invalidate_views();
+    if(m_last_error == SQLITE_DONE || m_last_error == timed_out) // stepping again would silently restart the statement
+      return false;
+
     if(!m_buffered_filled)
-      m_last_error = sqlite3_step(m_statement);
+      m_last_error = step();
 
     m_buffered_filled = false;
 
     return m_last_error == SQLITE_ROW;
   }
 
+  int query::step(void) noexcept
+  {
+    db* connection = owner();
+    std::chrono::steady_clock::time_point deadline = m_deadline;
+    if(connection != nullptr &&
+       deadline == std::chrono::steady_clock::time_point() &&
+       connection->m_timeout.count() > 0)
+    {
+      if(!sqlite3_stmt_busy(m_statement)) // first step of a run
+        m_run_deadline = std::chrono::steady_clock::now() + connection->m_timeout;
+      deadline = m_run_deadline;
+    }
+
+    if(connection == nullptr)
+      return sqlite3_step(m_statement);
+
+    int rval;
+    if(deadline == std::chrono::steady_clock::time_point())
+      rval = sqlite3_step(m_statement);
+    else
+    {
+      connection->arm_deadline(deadline);
+      rval = connection->disarm_deadline(sqlite3_step(m_statement));
+    }
+    connection->end_lock_wait();
+    return rval;
+  }
+
+  bool query::reset(void) noexcept
+  {
+    if(!valid())
+      return false;
+
+    m_arg = 0;
+    m_field = 0;
+    m_buffered_filled = false;
+    invalidate_views();
+    m_last_error = sqlite3_reset(m_statement);
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool query::clearBindings(void) noexcept
+  {
+    if(!valid())
+      return false;
+
+    m_arg = 0;
+    m_last_error = sqlite3_clear_bindings(m_statement);
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool query::begin_chunk(bool savepoint) noexcept
+  {
+    // outside of a transaction a savepoint behaves like BEGIN DEFERRED
+    db* connection = owner();
+    bool immediate = connection != nullptr && connection->m_busy_policy && connection->m_busy_policy->immediate_transactions;
+    m_last_error = sqlite3_exec(sqlite3_db_handle(m_statement),
+                                savepoint ? "SAVEPOINT sql_batch" : immediate ? "BEGIN IMMEDIATE" : "BEGIN",
+                                NULL, NULL, NULL);
+    if(connection != nullptr)
+      connection->end_lock_wait();
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool query::end_chunk(bool savepoint, bool commit) noexcept
+  {
+    sqlite3* handle = sqlite3_db_handle(m_statement);
+    sqlite3_reset(m_statement); // an active statement would keep the transaction open
+
+    if(commit)
+    {
+      int rval = sqlite3_exec(handle, savepoint ? "RELEASE sql_batch" : "COMMIT", NULL, NULL, NULL);
+      if(rval == SQLITE_OK)
+        return true;
+      m_last_error = rval;
+    }
+
+    if(savepoint)
+      sqlite3_exec(handle, "ROLLBACK TO sql_batch; RELEASE sql_batch", NULL, NULL, NULL);
+    else if(!sqlite3_get_autocommit(handle))
+      sqlite3_exec(handle, "ROLLBACK", NULL, NULL, NULL);
+    return false;
+  }
+
   void query::throw_if_error_binding(int errval)
   {
     m_last_error = errval;
@@ -126,53 +721,2167 @@ namespace sql
         "\n" + sqlite3_errstr(m_last_error);
   }
 
-  void query::throw_if_bad_field(int expected_type)
+  void query::throw_if_bad_field(int expected_type, int index)
   {
-    int field_type = sqlite3_column_type(m_statement, m_field);
-    if(!valid() || sqlite3_column_type(m_statement, m_field) != expected_type)
-      throw "field type mismatch for field: " + std::to_string(m_field) +
+    int field_type = valid() ? sqlite3_column_type(m_statement, index) : SQLITE_NULL;
+    if(field_type != expected_type)
+      throw "field type mismatch for field: " + std::to_string(index) +
         " of " + std::to_string(sqlite3_column_count(m_statement)) +
         "\nexpected type id: " + std::to_string(expected_type) +
         "\nrecieved type id: " + std::to_string(field_type);
   }
 
+  void query::throw_if_short_row(int columns)
+  {
+    int available = valid() ? sqlite3_column_count(m_statement) : 0;
+    if(available < columns)
+      throw "row has " + std::to_string(available) +
+        " columns but " + std::to_string(columns) + " were requested";
+  }
+
   int query::bind(const std::string& text, use_t use)
     { return sqlite3_bind_text(m_statement, m_arg, text.c_str(), text.size(), reinterpret_cast<sqlite3_destructor_type>(use)); }
 
   int query::bind(const std::string_view& text, use_t use)
     { return sqlite3_bind_text(m_statement, m_arg, text.data(), text.size(), reinterpret_cast<sqlite3_destructor_type>(use)); }
 
+  // lengths passed to the text16 functions are in bytes
   int query::bind(const std::wstring& text, use_t use)
-    { return sqlite3_bind_text16(m_statement, m_arg, text.c_str(), text.size(), reinterpret_cast<sqlite3_destructor_type>(use)); }
+  {
+    if constexpr (sizeof(wchar_t) == sizeof(char16_t))
+      return sqlite3_bind_text16(m_statement, m_arg, text.data(), text.size() * sizeof(char16_t), reinterpret_cast<sqlite3_destructor_type>(use));
+    std::u16string converted = detail::utf16_from_wstring(text);
+    return sqlite3_bind_text16(m_statement, m_arg, converted.data(), converted.size() * sizeof(char16_t), SQLITE_TRANSIENT);
+  }
 
   int query::bind(const std::u16string_view& text, use_t use)
-    { return sqlite3_bind_text16(m_statement, m_arg, text.data(), text.size(), reinterpret_cast<sqlite3_destructor_type>(use)); }
+    { return sqlite3_bind_text16(m_statement, m_arg, text.data(), text.size() * sizeof(char16_t), reinterpret_cast<sqlite3_destructor_type>(use)); }
 
   int query::bind(const std::vector<uint8_t>& blob, use_t use)
     { return sqlite3_bind_blob(m_statement, m_arg, blob.data(), blob.size(), reinterpret_cast<sqlite3_destructor_type>(use)); }
 
-  void query::field(std::string& text)
+  int query::bind(const std::span<const std::byte>& blob, use_t use)
+    { return sqlite3_bind_blob(m_statement, m_arg, blob.data(), blob.size(), reinterpret_cast<sqlite3_destructor_type>(use)); }
+
+  int query::bind(const zeroblob& blob, use_t)
+    { return sqlite3_bind_zeroblob64(m_statement, m_arg, blob.size); }
+
+  void query::field(std::string& text, int index)
+  {
+    throw_if_bad_field(SQLITE_TEXT, index);
+    read(text, index);
+  }
+
+  void query::field(std::wstring& text, int index)
+  {
+    throw_if_bad_field(SQLITE_TEXT, index);
+    read(text, index);
+  }
+
+  void query::field(std::u16string& text, int index)
+  {
+    throw_if_bad_field(SQLITE_TEXT, index);
+    read(text, index);
+  }
+
+  void query::field(std::vector<uint8_t>& blob, int index)
+  {
+    throw_if_bad_field(SQLITE_BLOB, index);
+    read(blob, index);
+  }
+
+  void query::field(std::string_view& text, int index)
+  {
+    throw_if_bad_field(SQLITE_TEXT, index);
+    read(text, index);
+  }
+
+  void query::field(std::u16string_view& text, int index)
+  {
+    throw_if_bad_field(SQLITE_TEXT, index);
+    read(text, index);
+  }
+
+  void query::field(std::span<const std::byte>& blob, int index)
+  {
+    throw_if_bad_field(SQLITE_BLOB, index);
+    read(blob, index);
+  }
+
+  void query::read(std::string& text, int index)
+  {
+    text = reinterpret_cast<const char*>(sqlite3_column_text(m_statement, index));
+  }
+
+  void query::read(std::wstring& text, int index)
+  {
+    const char16_t* data = static_cast<const char16_t*>(sqlite3_column_text16(m_statement, index));
+    text = detail::wstring_from_utf16(std::u16string_view(data, sqlite3_column_bytes16(m_statement, index) / sizeof(char16_t)));
+  }
+
+  void query::read(std::u16string& text, int index)
+  {
+    const char16_t* data = static_cast<const char16_t*>(sqlite3_column_text16(m_statement, index));
+    text.assign(data, sqlite3_column_bytes16(m_statement, index) / sizeof(char16_t));
+  }
+
+  void query::read(std::vector<uint8_t>& blob, int index)
+  {
+    blob.resize(sqlite3_column_bytes(m_statement, index));
+    std::memcpy(blob.data(), sqlite3_column_blob(m_statement, index), blob.size());
+  }
+
+  void query::read(std::string_view& text, int index)
+  {
+    const void* data = sqlite3_column_text(m_statement, index);
+    std::size_t size = sqlite3_column_bytes(m_statement, index); // must follow the conversion
+    text = std::string_view(static_cast<const char*>(view_of(data, size)), size);
+  }
+
+  void query::read(std::u16string_view& text, int index)
   {
-    throw_if_bad_field(SQLITE_TEXT);
-    text = reinterpret_cast<const char*>(sqlite3_column_text(m_statement, m_field));
+    const void* data = sqlite3_column_text16(m_statement, index);
+    std::size_t size = sqlite3_column_bytes16(m_statement, index);
+    text = std::u16string_view(static_cast<const char16_t*>(view_of(data, size)), size / sizeof(char16_t));
   }
 
-  void query::field(std::wstring& text)
+  void query::read(std::span<const std::byte>& blob, int index)
   {
-    throw_if_bad_field(SQLITE_TEXT);
-    text = static_cast<const wchar_t*>(sqlite3_column_text16(m_statement, m_field));
+    const void* data = sqlite3_column_blob(m_statement, index);
+    std::size_t size = sqlite3_column_bytes(m_statement, index);
+    blob = std::span<const std::byte>(static_cast<const std::byte*>(view_of(data, size)), size);
   }
 
-  void query::field(std::u16string& text)
+  // debug builds hand out views of a private copy that is poisoned and freed when the row
+  // changes, so reading a stale view shows garbage (or trips ASan/valgrind) instead of
+  // silently reading whatever SQLite reused the column buffer for
+  const void* query::view_of(const void* data, std::size_t size)
   {
-    throw_if_bad_field(SQLITE_TEXT);
-    text = static_cast<const char16_t*>(sqlite3_column_text16(m_statement, m_field));
+#ifdef NDEBUG
+    (void)size;
+    return data;
+#else
+    if(data == nullptr || size == 0) // nothing to go stale
+      return data;
+    const std::byte* begin = static_cast<const std::byte*>(data);
+    return m_view_buffers.emplace_back(begin, begin + size).data();
+#endif
   }
 
-  void query::field(std::vector<uint8_t>& blob)
+  void query::invalidate_views(void) noexcept
   {
-    throw_if_bad_field(SQLITE_BLOB);
-    blob.resize(sqlite3_column_bytes(m_statement, m_field));
-    std::memcpy(blob.data(), sqlite3_column_blob(m_statement, m_field), blob.size());
+#ifndef NDEBUG
+    for(std::vector<std::byte>& buffer : m_view_buffers)
+      std::memset(buffer.data(), 0xDD, buffer.size());
+    m_view_buffers.clear();
+#endif
+  }
+
+  pool::connection::connection(pool* owner, db* handle, std::size_t slot) noexcept
+    : m_pool(owner),
+      m_db(handle),
+      m_slot(slot)
+  {
+  }
+
+  pool::connection::connection(connection&& other) noexcept
+    : connection(other.m_pool, other.m_db, other.m_slot)
+  {
+    other.m_pool = nullptr;
+    other.m_db = nullptr;
+  }
+
+  pool::connection::~connection(void) noexcept
+  {
+    if(m_pool != nullptr)
+      m_pool->release(m_slot);
+  }
+
+  pool::pool(void) noexcept
+    : m_last_error(SQLITE_OK),
+      m_reader_count(0),
+      m_released(0)
+  {
+  }
+
+  pool::~pool(void) noexcept
+  {
+    close();
+  }
+
+  bool pool::open(const std::string_view& filename, std::size_t readers) noexcept
+  {
+    // the writer creates the file and switches it to WAL before any reader attaches
+    if(!m_writer.open(filename) ||
+       !m_writer.execute("PRAGMA journal_mode=WAL"))
+    {
+      m_last_error = m_writer.lastError();
+      m_writer.close();
+      return false;
+    }
+
+    m_readers.reset(new(std::nothrow) reader_slot[readers]);
+    if(m_readers == nullptr)
+    {
+      m_last_error = SQLITE_NOMEM;
+      close();
+      return false;
+    }
+
+    for(m_reader_count = 0; m_reader_count < readers; ++m_reader_count)
+    {
+      // each reader is only ever used by one thread at a time so SQLite's mutexes are redundant
+      if(!m_readers[m_reader_count].handle.open(filename,
+                                                SQLITE_OPEN_READONLY |
+                                                SQLITE_OPEN_NOMUTEX |
+                                                SQLITE_OPEN_EXRESCODE))
+      {
+        m_last_error = m_readers[m_reader_count].handle.lastError();
+        ++m_reader_count; // include the failed connection so close() releases its handle
+        close();
+        return false;
+      }
+    }
+
+    m_last_error = SQLITE_OK;
+    return true;
+  }
+
+  bool pool::close(void) noexcept
+  {
+    bool ok = true;
+    for(std::size_t pos = 0; pos < m_reader_count; ++pos)
+      ok &= m_readers[pos].handle.close();
+    m_readers.reset();
+    m_reader_count = 0;
+    ok &= m_writer.close();
+    return ok;
+  }
+
+  pool::connection pool::reader(void) noexcept
+  {
+    if(m_reader_count == 0)
+      return writer();
+
+    static std::atomic<std::size_t> next_thread_slot { 0 };
+    thread_local std::size_t preferred = next_thread_slot++;
+
+    for(;;)
+    {
+      uint32_t released = m_released.load(std::memory_order_acquire);
+      for(std::size_t pos = 0; pos < m_reader_count; ++pos)
+      {
+        std::size_t slot = (preferred + pos) % m_reader_count;
+        if(!m_readers[slot].busy.load(std::memory_order_relaxed) &&
+           !m_readers[slot].busy.exchange(true, std::memory_order_acquire))
+        {
+          preferred = slot;
+          return connection(this, &m_readers[slot].handle, slot);
+        }
+      }
+      m_released.wait(released, std::memory_order_acquire); // sleep until any reader is returned
+    }
+  }
+
+  pool::connection pool::writer(void) noexcept
+  {
+    m_writer_lock.lock();
+    return connection(this, &m_writer, writer_slot);
+  }
+
+  void pool::release(std::size_t slot) noexcept
+  {
+    if(slot == writer_slot)
+    {
+      m_writer_lock.unlock();
+      return;
+    }
+
+    m_readers[slot].busy.store(false, std::memory_order_release);
+    m_released.fetch_add(1, std::memory_order_release);
+    m_released.notify_one();
+  }
+
+  async_writer::async_writer(void) noexcept
+    : m_db(nullptr),
+      m_head(nullptr),
+      m_signal(0),
+      m_running(false),
+      m_pushing(0)
+  {
+  }
+
+  async_writer::~async_writer(void) noexcept
+  {
+    stop();
+  }
+
+  bool async_writer::start(db& target, const group_commit_options& options)
+  {
+    if(m_running.exchange(true))
+      return false;
+
+    m_db = &target;
+    m_options = options;
+    if(m_options.max_batch == 0)
+      m_options.max_batch = 1;
+    m_thread = std::thread(&async_writer::run, this);
+    return true;
+  }
+
+  void async_writer::stop(void) noexcept
+  {
+    if(!m_running.exchange(false))
+      return;
+
+    m_signal.fetch_add(1, std::memory_order_release);
+    m_signal.notify_one();
+    m_thread.join();
+    m_db = nullptr;
+  }
+
+  void async_writer::push(operation* op) noexcept
+  {
+    // a push that sees m_running is counted until linked, so run() can't exit in between
+    m_pushing.fetch_add(1);
+    if(!m_running.load())
+    {
+      m_pushing.fetch_sub(1);
+      if(op->done)
+        op->done(SQLITE_MISUSE);
+      delete op;
+      return;
+    }
+
+    // op belongs to the writer as soon as it is linked, keep the previous head locally
+    operation* previous = m_head.load(std::memory_order_relaxed);
+    do
+      op->next = previous;
+    while(!m_head.compare_exchange_weak(previous, op, std::memory_order_release, std::memory_order_relaxed));
+    m_pushing.fetch_sub(1);
+
+    if(previous == nullptr) // the writer may be asleep on an empty queue
+    {
+      m_signal.fetch_add(1, std::memory_order_release);
+      m_signal.notify_one();
+    }
+  }
+
+  void async_writer::run(void) noexcept
+  {
+    std::vector<operation*> batch;
+    for(;;)
+    {
+      uint32_t signal = m_signal.load(std::memory_order_acquire);
+      operation* head = m_head.exchange(nullptr, std::memory_order_acquire);
+      if(head == nullptr)
+      {
+        if(m_running.load())
+          m_signal.wait(signal, std::memory_order_acquire);
+        else if(m_pushing.load() != 0) // a late push is about to link its operation
+          std::this_thread::yield();
+        else if(m_head.load() == nullptr)
+          return;
+        continue;
+      }
+
+      // group more writers into this commit, unless it's already full or stop() is waiting
+      std::size_t queued = 0;
+      for(operation* op = head; op != nullptr && queued < m_options.max_batch; op = op->next)
+        ++queued;
+      if(m_options.max_delay.count() > 0 && queued < m_options.max_batch && m_running.load())
+      {
+        // in short slices so a stop() doesn't wait out the whole delay
+        std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + m_options.max_delay;
+        for(auto now = std::chrono::steady_clock::now(); now < until && m_running.load(); now = std::chrono::steady_clock::now())
+          std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(until - now, std::chrono::milliseconds(1)));
+        operation* late = m_head.exchange(nullptr, std::memory_order_acquire);
+        if(late != nullptr)
+        {
+          operation* tail = late;
+          while(tail->next != nullptr)
+            tail = tail->next;
+          tail->next = head;
+          head = late;
+        }
+      }
+
+      // the stack is newest first, restore submission order
+      std::size_t start = batch.size();
+      for(; head != nullptr; head = head->next)
+        batch.push_back(head);
+      std::reverse(batch.begin() + start, batch.end());
+
+      for(std::size_t pos = 0; pos < batch.size(); pos += m_options.max_batch)
+      {
+        std::vector<operation*> group(batch.begin() + pos,
+                                      batch.begin() + std::min(batch.size(), pos + m_options.max_batch));
+        commit(group);
+      }
+      batch.clear();
+    }
+  }
+
+  void async_writer::commit(std::vector<operation*>& batch) noexcept
+  {
+    std::vector<int> results(batch.size(), SQLITE_OK);
+    std::size_t first_in_transaction = 0;
+    bool in_transaction = m_db->execute("BEGIN IMMEDIATE");
+
+    for(std::size_t pos = 0; pos < batch.size(); ++pos)
+    {
+      operation* op = batch[pos];
+      try
+      {
+        query q = m_db->build_query(op->sql);
+        op->bind(q);
+        if(!q.execute())
+          results[pos] = q.lastError();
+      }
+      catch(...) // build_query() and arg() report errors by throwing
+      {
+        results[pos] = SQLITE_ERROR;
+      }
+
+      // most errors only undo the failing statement, but some abort the whole transaction
+      if(results[pos] != SQLITE_OK && in_transaction && sqlite3_get_autocommit(m_db->getHandle()))
+      {
+        for(std::size_t lost = first_in_transaction; lost < pos; ++lost)
+          if(results[lost] == SQLITE_OK)
+            results[lost] = results[pos];
+        first_in_transaction = pos + 1;
+        in_transaction = m_db->execute("BEGIN IMMEDIATE");
+      }
+    }
+
+    if(in_transaction && !m_db->execute("COMMIT"))
+    {
+      int rval = m_db->lastError();
+      m_db->execute("ROLLBACK");
+      for(std::size_t pos = first_in_transaction; pos < batch.size(); ++pos)
+        if(results[pos] == SQLITE_OK)
+          results[pos] = rval;
+    }
+
+    for(std::size_t pos = 0; pos < batch.size(); ++pos)
+    {
+      if(batch[pos]->done)
+        batch[pos]->done(results[pos]);
+      delete batch[pos];
+    }
+  }
+
+  byte_sink ostream_sink(std::ostream& out)
+  {
+    return [&out](std::span<const std::byte> data)
+      { return bool(out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()))); };
+  }
+
+  byte_source istream_source(std::istream& in)
+  {
+    return [&in](std::span<std::byte> buffer) -> std::size_t
+    {
+      in.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(buffer.size()));
+      return std::size_t(in.gcount());
+    };
+  }
+
+  namespace
+  {
+    constexpr char stream_magic[4] = { 'S', 'Q', 'L', 'R' };
+    constexpr std::byte stream_version { 1 };
+    constexpr std::size_t minimum_stream_buffer = 64;
+
+    class stream_writer
+    {
+    public:
+      stream_writer(const byte_sink& sink, std::size_t capacity)
+        : m_sink(sink),
+          m_capacity(std::max(capacity, minimum_stream_buffer))
+      {
+        m_buffer.reserve(m_capacity);
+      }
+
+      void put(const void* data, std::size_t size)
+      {
+        if(m_buffer.size() + size > m_capacity)
+          flush();
+        const std::byte* bytes = static_cast<const std::byte*>(data);
+        if(size >= m_capacity) // no point copying it through the buffer
+          write({ bytes, size });
+        else
+          m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+      }
+
+      void put(std::string_view text) { put(text.data(), text.size()); }
+
+      void put(std::byte value)
+      {
+        if(m_buffer.size() == m_capacity)
+          flush();
+        m_buffer.push_back(value);
+      }
+
+      void varint(uint64_t value)
+      {
+        std::byte encoded[10];
+        std::size_t size = 0;
+        do
+        {
+          encoded[size] = std::byte(value & 0x7f);
+          value >>= 7;
+          if(value != 0)
+            encoded[size] |= std::byte(0x80);
+          ++size;
+        } while(value != 0);
+        put(encoded, size);
+      }
+
+      void flush(void)
+      {
+        if(!m_buffer.empty())
+          write(m_buffer);
+        m_buffer.clear();
+      }
+
+    private:
+      void write(std::span<const std::byte> data)
+      {
+        if(!m_sink(data))
+          throw std::string("export: the sink failed");
+      }
+
+      const byte_sink& m_sink;
+      std::size_t m_capacity;
+      std::vector<std::byte> m_buffer;
+    };
+
+    class stream_reader
+    {
+    public:
+      stream_reader(const byte_source& source, std::size_t capacity)
+        : m_source(source),
+          m_buffer(std::max(capacity, minimum_stream_buffer)),
+          m_begin(0),
+          m_end(0)
+      {
+      }
+
+      // false when the input ends before count bytes are available
+      bool fill(std::size_t count)
+      {
+        if(m_end - m_begin >= count)
+          return true;
+
+        std::memmove(m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+        m_end -= m_begin;
+        m_begin = 0;
+        if(m_buffer.size() < count) // a single value larger than the buffer
+          m_buffer.resize(count);
+
+        while(m_end < count)
+        {
+          std::size_t size = m_source(std::span<std::byte>(m_buffer).subspan(m_end));
+          if(size == 0)
+            return false;
+          m_end += size;
+        }
+        return true;
+      }
+
+      bool at_end(void) { return !fill(1); }
+      std::byte peek(void) { return fill(1) ? m_buffer[m_begin] : std::byte(0); }
+
+      // the bytes stay valid until the next read
+      const std::byte* take(std::size_t count)
+      {
+        if(!fill(count))
+          throw std::string("import: truncated input");
+        const std::byte* data = m_buffer.data() + m_begin;
+        m_begin += count;
+        return data;
+      }
+
+      std::byte next(void) { return *take(1); }
+
+      // whatever is buffered, at least one byte unless the input ended, valid until the next read
+      std::span<const std::byte> available(void)
+      {
+        fill(1);
+        return std::span<const std::byte>(m_buffer).subspan(m_begin, m_end - m_begin);
+      }
+      void skip(std::size_t count) noexcept { m_begin += std::min(count, m_end - m_begin); }
+
+      uint64_t varint(void)
+      {
+        uint64_t value = 0;
+        for(int shift = 0; shift < 64; shift += 7)
+        {
+          std::byte part = next();
+          value |= uint64_t(part & std::byte(0x7f)) << shift;
+          if((part & std::byte(0x80)) == std::byte(0))
+            return value;
+        }
+        throw std::string("import: malformed varint");
+      }
+
+    private:
+      const byte_source& m_source;
+      std::vector<std::byte> m_buffer;
+      std::size_t m_begin;
+      std::size_t m_end;
+    };
+
+    void write_binary_value(stream_writer& out, sqlite3_stmt* statement, int index)
+    {
+      int type = sqlite3_column_type(statement, index);
+      out.put(std::byte(type));
+      switch(type)
+      {
+        case SQLITE_INTEGER:
+        {
+          int64_t value = sqlite3_column_int64(statement, index);
+          out.varint((uint64_t(value) << 1) ^ uint64_t(value >> 63)); // zigzag keeps small negatives short
+          break;
+        }
+        case SQLITE_FLOAT:
+        {
+          uint64_t bits = std::bit_cast<uint64_t>(sqlite3_column_double(statement, index));
+          std::byte encoded[8];
+          for(std::byte& part : encoded)
+          {
+            part = std::byte(bits & 0xff);
+            bits >>= 8;
+          }
+          out.put(encoded, sizeof(encoded));
+          break;
+        }
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+        {
+          const void* data = type == SQLITE_TEXT ? static_cast<const void*>(sqlite3_column_text(statement, index))
+                                                 : sqlite3_column_blob(statement, index);
+          std::size_t size = sqlite3_column_bytes(statement, index);
+          out.varint(size);
+          out.put(data, size);
+          break;
+        }
+      }
+    }
+
+    void bind_binary_value(stream_reader& in, sqlite3_stmt* statement, int index)
+    {
+      int rval = SQLITE_OK;
+      switch(int(in.next()))
+      {
+        case SQLITE_INTEGER:
+        {
+          uint64_t value = in.varint();
+          rval = sqlite3_bind_int64(statement, index, int64_t((value >> 1) ^ (~(value & 1) + 1)));
+          break;
+        }
+        case SQLITE_FLOAT:
+        {
+          const std::byte* encoded = in.take(8);
+          uint64_t bits = 0;
+          for(int i = 7; i >= 0; --i)
+            bits = (bits << 8) | uint64_t(encoded[i]);
+          rval = sqlite3_bind_double(statement, index, std::bit_cast<double>(bits));
+          break;
+        }
+        case SQLITE_TEXT:
+        {
+          std::size_t size = in.varint();
+          rval = sqlite3_bind_text64(statement, index, reinterpret_cast<const char*>(in.take(size)), size, SQLITE_TRANSIENT, SQLITE_UTF8);
+          break;
+        }
+        case SQLITE_BLOB:
+        {
+          std::size_t size = in.varint();
+          rval = sqlite3_bind_blob64(statement, index, in.take(size), size, SQLITE_TRANSIENT);
+          break;
+        }
+        case SQLITE_NULL:
+          rval = sqlite3_bind_null(statement, index);
+          break;
+        default:
+          throw std::string("import: unknown value type");
+      }
+      if(rval != SQLITE_OK)
+        throw "import: " + std::string(sqlite3_errstr(rval));
+    }
+
+    // unquoted fields read back as numbers only in the spelling export writes them in,
+    // so hand written values like 007 or 1.50 stay text
+    int csv_number_type(std::string_view field, int64_t& integer, double& real)
+    {
+      const char* first = field.data();
+      const char* last = first + field.size();
+      char spelling[32];
+      std::from_chars_result parsed = std::from_chars(first, last, integer);
+      if(parsed.ec == std::errc() && parsed.ptr == last)
+      {
+        std::string_view canonical(spelling, std::to_chars(spelling, spelling + sizeof(spelling), integer).ptr - spelling);
+        return canonical == field ? SQLITE_INTEGER : SQLITE_TEXT;
+      }
+
+      parsed = std::from_chars(first, last, real);
+      if(parsed.ec != std::errc() || parsed.ptr != last)
+        return SQLITE_TEXT;
+      std::string_view canonical(spelling, std::to_chars(spelling, spelling + sizeof(spelling), real).ptr - spelling);
+      if(canonical.find_first_not_of("-0123456789") == std::string_view::npos)
+        return field.size() == canonical.size() + 2 && field.starts_with(canonical) && field.ends_with(".0") ? SQLITE_FLOAT : SQLITE_TEXT;
+      return canonical == field ? SQLITE_FLOAT : SQLITE_TEXT;
+    }
+
+    // blobs are written as SQL blob literals, X'0a1b'
+    bool is_csv_blob(std::string_view field)
+    {
+      if(field.size() < 3 || (field[0] != 'X' && field[0] != 'x') || field[1] != '\'' || field.back() != '\'')
+        return false;
+      field = field.substr(2, field.size() - 3);
+      return field.size() % 2 == 0 && field.find_first_not_of("0123456789abcdefABCDEF") == std::string_view::npos;
+    }
+
+    int bind_csv_blob(sqlite3_stmt* statement, int index, std::string_view field)
+    {
+      auto nibble = [](char c) { return uint8_t(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10); };
+      field = field.substr(2, field.size() - 3);
+      std::vector<uint8_t> data(field.size() / 2);
+      for(std::size_t i = 0; i < data.size(); ++i)
+        data[i] = uint8_t(nibble(field[2 * i]) << 4 | nibble(field[2 * i + 1]));
+      if(data.empty()) // a null pointer would bind NULL
+        return sqlite3_bind_zeroblob(statement, index, 0);
+      return sqlite3_bind_blob64(statement, index, data.data(), data.size(), SQLITE_TRANSIENT);
+    }
+
+    void write_csv_text(stream_writer& out, std::string_view text)
+    {
+      int64_t integer;
+      double real;
+      if(!text.empty() && text.find_first_of(",\"\r\n") == std::string_view::npos &&
+         csv_number_type(text, integer, real) == SQLITE_TEXT && !is_csv_blob(text))
+      {
+        out.put(text);
+        return;
+      }
+
+      out.put(std::byte('"')); // empty text is quoted to tell it apart from NULL, numbers and blobs
+      for(std::size_t quote; (quote = text.find('"')) != std::string_view::npos; text.remove_prefix(quote + 1))
+      {
+        out.put(text.substr(0, quote + 1));
+        out.put(std::byte('"'));
+      }
+      out.put(text);
+      out.put(std::byte('"'));
+    }
+
+    void write_csv_value(stream_writer& out, sqlite3_stmt* statement, int index)
+    {
+      char number[32];
+      switch(sqlite3_column_type(statement, index))
+      {
+        case SQLITE_INTEGER:
+          out.put(number, std::to_chars(number, number + sizeof(number), sqlite3_column_int64(statement, index)).ptr - number);
+          break;
+        case SQLITE_FLOAT:
+        {
+          std::string_view text(number, std::to_chars(number, number + sizeof(number), sqlite3_column_double(statement, index)).ptr - number);
+          out.put(text);
+          if(text.find_first_not_of("-0123456789") == std::string_view::npos)
+            out.put(".0"); // keeps integral reals apart from integers
+          break;
+        }
+        case SQLITE_TEXT:
+          write_csv_text(out, std::string_view(reinterpret_cast<const char*>(sqlite3_column_text(statement, index)),
+                                               sqlite3_column_bytes(statement, index)));
+          break;
+        case SQLITE_BLOB:
+        {
+          static constexpr char digits[] = "0123456789abcdef";
+          const uint8_t* data = static_cast<const uint8_t*>(sqlite3_column_blob(statement, index));
+          int size = sqlite3_column_bytes(statement, index);
+          out.put("X'");
+          for(int i = 0; i < size; ++i)
+          {
+            out.put(std::byte(digits[data[i] >> 4]));
+            out.put(std::byte(digits[data[i] & 0xf]));
+          }
+          out.put(std::byte('\''));
+          break;
+        }
+      }
+    }
+
+    // false at the end of the input, quoted tells empty text from NULL
+    bool read_csv_row(stream_reader& in, std::vector<std::string>& fields, std::vector<bool>& quoted)
+    {
+      fields.clear();
+      quoted.clear();
+      if(in.at_end())
+        return false;
+
+      std::string field;
+      bool was_quoted = false;
+      bool in_quotes = false;
+      auto finish_field = [&]
+      {
+        fields.push_back(std::move(field));
+        quoted.push_back(was_quoted);
+        field.clear();
+        was_quoted = false;
+      };
+
+      // plain runs of text are appended whole, only delimiters, quotes and line ends stop the scan
+      for(std::span<const std::byte> buffered = in.available(); !buffered.empty(); buffered = in.available())
+      {
+        std::string_view text(reinterpret_cast<const char*>(buffered.data()), buffered.size());
+        std::size_t stop = in_quotes ? text.find('"') : text.find_first_of(",\r\n\"");
+        field.append(text.substr(0, stop));
+        if(stop == std::string_view::npos)
+        {
+          in.skip(text.size());
+          continue;
+        }
+        char c = text[stop];
+        in.skip(stop + 1);
+
+        if(in_quotes)
+        {
+          if(in.peek() == std::byte('"'))
+            field += char(in.next());
+          else
+            in_quotes = false;
+        }
+        else if(c == '"')
+        {
+          if(field.empty() && !was_quoted)
+            in_quotes = was_quoted = true;
+          else
+            field += c;
+        }
+        else if(c == ',')
+          finish_field();
+        else
+        {
+          if(c == '\r' && in.peek() == std::byte('\n'))
+            in.next();
+          finish_field();
+          return true;
+        }
+      }
+
+      if(in_quotes)
+        throw std::string("import: unterminated quoted field");
+      finish_field();
+      return true;
+    }
+
+    std::string quote_identifier(std::string_view name)
+    {
+      std::string quoted = "\"";
+      for(char c : name)
+        quoted.append(c == '"' ? 2 : 1, c);
+      return quoted.append("\"");
+    }
+  }
+
+  std::size_t export_stream(query& source, const byte_sink& sink, const stream_options& options)
+  {
+    if(!source.valid())
+      throw std::string("export: invalid query");
+
+    stream_writer out(sink, options.buffer_size);
+    sqlite3_stmt* statement = source.m_statement;
+    int columns = sqlite3_column_count(statement);
+    bool binary = options.format == stream_format::binary;
+
+    if(binary)
+    {
+      out.put(stream_magic, sizeof(stream_magic));
+      out.put(stream_version);
+      out.varint(columns);
+    }
+    for(int i = 0; i < columns; ++i)
+    {
+      std::string_view name = sqlite3_column_name(statement, i);
+      if(binary)
+      {
+        out.varint(name.size());
+        out.put(name);
+      }
+      else
+      {
+        if(i != 0)
+          out.put(std::byte(','));
+        write_csv_text(out, name);
+      }
+    }
+    if(!binary)
+      out.put("\r\n");
+
+    std::size_t rows = 0;
+    while(source.fetchRow())
+    {
+      for(int i = 0; i < columns; ++i)
+      {
+        if(binary)
+          write_binary_value(out, statement, i);
+        else
+        {
+          if(i != 0)
+            out.put(std::byte(','));
+          write_csv_value(out, statement, i);
+        }
+      }
+      if(!binary)
+        out.put("\r\n");
+      ++rows;
+    }
+
+    if(source.lastError() != SQLITE_DONE)
+      throw "export: " + std::string(sqlite3_errstr(source.lastError()));
+    out.flush();
+    return rows;
+  }
+
+  std::size_t import_stream(db& target, const byte_source& source, const std::string_view& table, const stream_options& options)
+  {
+    stream_reader in(source, options.buffer_size);
+    bool binary = options.format == stream_format::binary;
+    std::vector<std::string> names;
+    std::vector<std::string> fields;
+    std::vector<bool> quoted;
+
+    if(binary)
+    {
+      if(in.at_end())
+        return 0;
+      if(std::memcmp(in.take(sizeof(stream_magic)), stream_magic, sizeof(stream_magic)) != 0)
+        throw std::string("import: not a binary row stream");
+      if(in.next() != stream_version)
+        throw std::string("import: unsupported stream version");
+      for(uint64_t count = in.varint(); count > 0; --count)
+      {
+        std::size_t size = in.varint();
+        names.emplace_back(reinterpret_cast<const char*>(in.take(size)), size);
+      }
+    }
+    else if(!read_csv_row(in, names, quoted))
+      return 0;
+
+    if(names.empty())
+      throw std::string("import: no columns");
+
+    std::string insert_sql = "INSERT INTO " + quote_identifier(table) + "(";
+    for(std::size_t i = 0; i < names.size(); ++i)
+      insert_sql.append(i ? ", " : "").append(quote_identifier(names[i]));
+    insert_sql.append(") VALUES(");
+    for(std::size_t i = 0; i < names.size(); ++i)
+      insert_sql.append(i ? ", ?" : "?");
+    insert_sql.append(")");
+
+    query insert = target.build_query(insert_sql);
+    sqlite3_stmt* statement = insert.m_statement;
+    bool savepoint = !sqlite3_get_autocommit(sqlite3_db_handle(statement)); // nest in the caller's transaction
+    std::size_t committed = 0;
+    std::size_t pending = 0;
+    bool in_chunk = false;
+
+    auto fail = [&](const std::string& reason)
+    {
+      return "import: " + reason + " at row " + std::to_string(committed + pending + 1) +
+             ", " + std::to_string(committed) + " rows committed";
+    };
+
+    try
+    {
+      for(;;)
+      {
+        if(binary ? in.at_end() : !read_csv_row(in, fields, quoted))
+          break;
+        if(!binary && fields.size() == 1 && fields[0].empty() && !quoted[0]) // blank line
+          continue;
+        if(!binary && fields.size() != names.size())
+          throw fail(std::to_string(fields.size()) + " fields instead of " + std::to_string(names.size()));
+
+        if(!in_chunk)
+        {
+          if(!insert.begin_chunk(savepoint))
+            throw fail(sqlite3_errstr(insert.lastError()));
+          in_chunk = true;
+        }
+
+        for(int i = 0; i < int(names.size()); ++i)
+        {
+          int64_t integer = 0;
+          double real = 0;
+          int type = binary || quoted[i] ? SQLITE_TEXT : csv_number_type(fields[i], integer, real);
+          int rval = SQLITE_OK;
+          if(binary)
+            bind_binary_value(in, statement, i + 1);
+          else if(quoted[i])
+            rval = sqlite3_bind_text64(statement, i + 1, fields[i].data(), fields[i].size(), SQLITE_STATIC, SQLITE_UTF8);
+          else if(fields[i].empty())
+            rval = sqlite3_bind_null(statement, i + 1);
+          else if(type == SQLITE_INTEGER)
+            rval = sqlite3_bind_int64(statement, i + 1, integer);
+          else if(type == SQLITE_FLOAT)
+            rval = sqlite3_bind_double(statement, i + 1, real);
+          else if(is_csv_blob(fields[i]))
+            rval = bind_csv_blob(statement, i + 1, fields[i]);
+          else // the column's affinity decides what other unquoted text becomes
+            rval = sqlite3_bind_text64(statement, i + 1, fields[i].data(), fields[i].size(), SQLITE_STATIC, SQLITE_UTF8);
+          if(rval != SQLITE_OK)
+            throw fail("binding failed");
+        }
+
+        if(!insert.execute())
+          throw fail(sqlite3_errmsg(sqlite3_db_handle(statement)));
+        sqlite3_reset(statement);
+
+        if(++pending == options.chunk_rows)
+        {
+          in_chunk = false;
+          if(!insert.end_chunk(savepoint, true))
+            throw fail(sqlite3_errstr(insert.lastError()));
+          committed += pending;
+          pending = 0;
+        }
+      }
+
+      if(in_chunk)
+      {
+        in_chunk = false;
+        if(!insert.end_chunk(savepoint, true))
+          throw fail(sqlite3_errstr(insert.lastError()));
+        committed += pending;
+      }
+    }
+    catch(...)
+    {
+      if(in_chunk)
+        insert.end_chunk(savepoint, false);
+      throw;
+    }
+    return committed;
+  }
+
+  checkpointer::checkpointer(void) noexcept
+    : m_target(nullptr),
+      m_page_size(0),
+      m_autocheckpoint(0),
+      m_last_error(SQLITE_OK),
+      m_running(false),
+      m_wal_frames(0),
+      m_last_commit(0),
+      m_stats{}
+  {
+  }
+
+  checkpointer::~checkpointer(void) noexcept
+  {
+    stop();
+  }
+
+  bool checkpointer::start(db& target, const checkpoint_options& options)
+  {
+    if(m_running.load())
+      return false;
+
+    const char* filename = sqlite3_db_filename(target.getHandle(), "main");
+    if(filename == nullptr || *filename == '\0') // in-memory and temporary databases have no WAL
+    {
+      m_last_error = SQLITE_MISUSE;
+      return false;
+    }
+
+    if(!m_connection.open(filename, SQLITE_OPEN_READWRITE | SQLITE_OPEN_EXRESCODE))
+    {
+      m_last_error = m_connection.lastError();
+      return false;
+    }
+    sqlite3_wal_autocheckpoint(m_connection.getHandle(), 0);
+    sqlite3_busy_timeout(m_connection.getHandle(), int(options.restart_wait.count()));
+
+    // reading the journal mode also opens the WAL on this connection
+    std::string mode;
+    for(std::string_view value : m_connection.build_query("PRAGMA journal_mode").rows<std::string_view>())
+      mode = value;
+    if(mode != "wal")
+    {
+      m_connection.close();
+      m_last_error = SQLITE_MISUSE;
+      return false;
+    }
+
+    m_page_size = 0;
+    for(int64_t size : m_connection.build_query("PRAGMA page_size").rows<int64_t>())
+      m_page_size = size;
+
+    m_autocheckpoint = 0; // restored by stop(), zero when the target had it turned off
+    for(int64_t pages : target.build_query("PRAGMA wal_autocheckpoint").rows<int64_t>())
+      m_autocheckpoint = int(pages);
+
+    m_target = &target;
+    m_options = options;
+    m_stats = checkpoint_stats {};
+    m_last_commit.store(std::chrono::steady_clock::now().time_since_epoch().count());
+    m_running.store(true);
+    sqlite3_wal_hook(target.getHandle(), wal_committed, this); // also turns off auto-checkpoint
+    m_thread = std::thread(&checkpointer::run, this);
+    return true;
+  }
+
+  void checkpointer::stop(void) noexcept
+  {
+    if(!m_running.exchange(false))
+      return;
+
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_wakeup.notify_one();
+    }
+    m_thread.join();
+    sqlite3_wal_autocheckpoint(m_target->getHandle(), m_autocheckpoint);
+    m_connection.close();
+    m_target = nullptr;
+  }
+
+  checkpoint_stats checkpointer::stats(void) const noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats;
+  }
+
+  // runs on the writer inside every commit, only publishes the WAL size
+  int checkpointer::wal_committed(void* context, sqlite3*, const char* schema, int frames) noexcept
+  {
+    checkpointer& self = *static_cast<checkpointer*>(context);
+    if(std::strcmp(schema, "main") != 0)
+      return SQLITE_OK;
+
+    self.m_wal_frames.store(frames, std::memory_order_relaxed);
+    self.m_last_commit.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    if(frames >= self.m_options.passive_frames)
+      self.m_wakeup.notify_one();
+    return SQLITE_OK;
+  }
+
+  void checkpointer::run(void) noexcept
+  {
+    int64_t backlog = 0; // frames written since the last complete checkpoint
+    int last_frames = 0;
+    std::unique_lock<std::mutex> lock(m_lock);
+    while(m_running.load(std::memory_order_acquire))
+    {
+      m_wakeup.wait_for(lock, m_options.poll_interval);
+      if(!m_running.load(std::memory_order_acquire))
+        break;
+
+      int frames = m_wal_frames.load(std::memory_order_relaxed);
+      if(frames != last_frames) // a writer restarted the WAL when it shrinks
+        backlog += frames > last_frames ? frames - last_frames : frames;
+      last_frames = frames;
+      m_stats.wal_frames = frames;
+      m_stats.wal_bytes = frames * (m_page_size + 24); // each frame has a 24 byte header
+
+      std::chrono::steady_clock::duration idle = std::chrono::steady_clock::now().time_since_epoch() -
+          std::chrono::steady_clock::duration(m_last_commit.load(std::memory_order_relaxed));
+
+      if(backlog == 0)
+        continue;
+
+      int mode = -1;
+      if(frames >= m_options.restart_frames)
+        mode = SQLITE_CHECKPOINT_RESTART;
+      else if(backlog >= m_options.passive_frames || idle >= m_options.idle_time)
+        mode = SQLITE_CHECKPOINT_PASSIVE;
+      if(mode < 0)
+        continue;
+
+      lock.unlock(); // stats() stays available while the checkpoint runs
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      int log = 0, done = 0;
+      int rval = sqlite3_wal_checkpoint_v2(m_connection.getHandle(), "main", mode, &log, &done);
+      uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+      lock.lock();
+
+      ++(mode == SQLITE_CHECKPOINT_RESTART ? m_stats.restarts : m_stats.passive);
+      m_stats.last_ns = elapsed;
+      m_stats.max_ns = std::max(m_stats.max_ns, elapsed);
+      m_stats.total_ns += elapsed;
+      if(rval == SQLITE_OK && log < 0) // no longer in WAL mode
+        rval = SQLITE_MISUSE;
+      if(rval == SQLITE_BUSY || (rval == SQLITE_OK && done < log))
+        ++m_stats.busy;
+      else if(rval != SQLITE_OK)
+        ++m_stats.errors;
+      if(rval == SQLITE_OK)
+      {
+        m_stats.frames_checkpointed += std::max(0, done);
+        backlog = std::max(0, log - done);
+        if(mode == SQLITE_CHECKPOINT_RESTART && backlog == 0)
+        {
+          last_frames = 0; // the next writer starts the WAL over
+          m_wal_frames.store(0, std::memory_order_relaxed);
+          m_stats.wal_frames = 0;
+          m_stats.wal_bytes = 0;
+        }
+      }
+    }
+  }
+
+  // FNV-1a, keys are usually short
+  static uint64_t default_shard_hash(std::span<const std::byte> key) noexcept
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for(std::byte value : key)
+      hash = (hash ^ uint64_t(value)) * 1099511628211ULL;
+    return hash;
+  }
+
+  sharded_db::sharded_db(void) noexcept
+    : m_last_error(SQLITE_OK),
+      m_running(false)
+  {
+  }
+
+  sharded_db::~sharded_db(void) noexcept
+  {
+    close();
+  }
+
+  bool sharded_db::open(const std::vector<std::string>& filenames, hash_function hash, std::size_t threads)
+  {
+    close();
+    if(filenames.empty())
+    {
+      m_last_error = SQLITE_MISUSE;
+      return false;
+    }
+
+    for(const std::string& filename : filenames)
+    {
+      m_shards.push_back(std::make_unique<db>());
+      if(!m_shards.back()->open(filename))
+      {
+        m_last_error = m_shards.back()->lastError();
+        close();
+        return false;
+      }
+    }
+    m_hash = hash ? std::move(hash) : hash_function(default_shard_hash);
+
+    if(threads == 0)
+      threads = std::min<std::size_t>(filenames.size(), std::max(1u, std::thread::hardware_concurrency()));
+    m_running = true;
+    for(std::size_t i = 0; i < threads; ++i)
+      m_workers.emplace_back(&sharded_db::work, this);
+
+    m_last_error = SQLITE_OK;
+    return true;
+  }
+
+  bool sharded_db::close(void) noexcept
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_running = false;
+    }
+    m_wakeup.notify_all();
+    for(std::thread& worker : m_workers)
+      worker.join();
+    m_workers.clear();
+
+    bool closed = true;
+    for(std::unique_ptr<db>& shard : m_shards)
+      closed = shard->close() && closed;
+    m_shards.clear();
+    return closed;
+  }
+
+  bool sharded_db::execute(const std::string_view& sql_str)
+  {
+    std::vector<int> errors(m_shards.size(), SQLITE_OK);
+    parallel([&](db& shard, std::size_t index)
+    {
+      if(!shard.execute(sql_str))
+        errors[index] = shard.lastError();
+    });
+
+    m_last_error = SQLITE_OK;
+    for(int error : errors)
+    {
+      if(error != SQLITE_OK)
+      {
+        m_last_error = error;
+        break;
+      }
+    }
+    return m_last_error == SQLITE_OK;
+  }
+
+  void sharded_db::submit(std::function<void(void)> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_tasks.push_back(std::move(task));
+    }
+    m_wakeup.notify_one();
+  }
+
+  void sharded_db::work(void) noexcept
+  {
+    std::unique_lock<std::mutex> lock(m_lock);
+    for(;;)
+    {
+      m_wakeup.wait(lock, [this] { return !m_tasks.empty() || !m_running; });
+      if(m_tasks.empty())
+        return;
+
+      std::function<void(void)> task = std::move(m_tasks.back());
+      m_tasks.pop_back();
+      lock.unlock();
+      task(); // tasks from parallel() catch their own exceptions
+      lock.lock();
+    }
+  }
+
+  blob_stream::blob_stream(void) noexcept
+    : m_blob(nullptr),
+      m_position(0),
+      m_last_error(SQLITE_OK)
+  {
+  }
+
+  blob_stream::~blob_stream(void) noexcept
+  {
+    close();
+  }
+
+  bool blob_stream::open(db& database,
+                         const std::string& table,
+                         const std::string& column,
+                         int64_t rowid,
+                         bool writable,
+                         const std::string& schema) noexcept
+  {
+    close();
+    m_position = 0;
+    m_last_error = sqlite3_blob_open(database.getHandle(),
+                                     schema.c_str(),
+                                     table.c_str(),
+                                     column.c_str(),
+                                     rowid,
+                                     writable ? 1 : 0,
+                                     &m_blob);
+    if(m_last_error != SQLITE_OK)
+      close(); // a handle may be returned even on failure
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool blob_stream::reopen(int64_t rowid) noexcept
+  {
+    if(!valid())
+      return false;
+    m_position = 0;
+    m_last_error = sqlite3_blob_reopen(m_blob, rowid);
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool blob_stream::close(void) noexcept
+  {
+    if(!valid())
+      return true;
+    int rval = sqlite3_blob_close(m_blob); // always releases the handle
+    m_blob = nullptr;
+    if(rval != SQLITE_OK)
+      m_last_error = rval;
+    return rval == SQLITE_OK;
+  }
+
+  int blob_stream::size(void) const noexcept
+  {
+    return valid() ? sqlite3_blob_bytes(m_blob) : 0;
+  }
+
+  bool blob_stream::seek(int position) noexcept
+  {
+    if(position < 0 || position > size())
+      return false;
+    m_position = position;
+    return true;
+  }
+
+  int blob_stream::read(std::span<std::byte> buffer) noexcept
+  {
+    int count = int(std::min<std::size_t>(buffer.size(), size() - m_position));
+    if(count <= 0 || !readAt(buffer.first(count), m_position))
+      return 0;
+    m_position += count;
+    return count;
+  }
+
+  int blob_stream::write(std::span<const std::byte> buffer) noexcept
+  {
+    int count = int(std::min<std::size_t>(buffer.size(), size() - m_position));
+    if(count <= 0 || !writeAt(buffer.first(count), m_position))
+      return 0;
+    m_position += count;
+    return count;
+  }
+
+  bool blob_stream::readAt(std::span<std::byte> buffer, int offset) noexcept
+  {
+    if(!valid())
+      return false;
+    m_last_error = sqlite3_blob_read(m_blob, buffer.data(), int(buffer.size()), offset);
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool blob_stream::writeAt(std::span<const std::byte> buffer, int offset) noexcept
+  {
+    if(!valid())
+      return false;
+    m_last_error = sqlite3_blob_write(m_blob, buffer.data(), int(buffer.size()), offset);
+    return m_last_error == SQLITE_OK;
+  }
+
+  // the chunk holds either read ahead or pending writes, never both: the put area stays
+  // empty while reading, so the first write after a read reaches overflow() and can
+  // rewind over the read ahead before arming it
+  blob_streambuf::blob_streambuf(blob_stream& blob, std::size_t chunk_size)
+    : m_blob(blob),
+      m_chunk(chunk_size)
+  {
+    setg(m_chunk.data(), m_chunk.data(), m_chunk.data()); // empty get area
+    setp(nullptr, nullptr); // and no put area until the first write
+  }
+
+  blob_streambuf::~blob_streambuf(void)
+  {
+    flush_chunk();
+  }
+
+  bool blob_streambuf::flush_chunk(void) noexcept
+  {
+    std::size_t pending = pptr() - pbase();
+    bool ok = pending == 0 ||
+              m_blob.write(std::as_bytes(std::span(pbase(), pending))) == int(pending);
+    setp(nullptr, nullptr);
+    return ok;
+  }
+
+  blob_streambuf::int_type blob_streambuf::underflow(void)
+  {
+    if(!flush_chunk()) // switching from writing to reading
+      return traits_type::eof();
+
+    int count = m_blob.read(std::as_writable_bytes(std::span(m_chunk)));
+    setg(m_chunk.data(), m_chunk.data(), m_chunk.data() + count);
+    return count > 0 ? traits_type::to_int_type(m_chunk.front()) : traits_type::eof();
+  }
+
+  blob_streambuf::int_type blob_streambuf::overflow(int_type ch)
+  {
+    if(!flush_chunk())
+      return traits_type::eof();
+
+    if(gptr() != egptr()) // switching from reading to writing, drop the read ahead
+    {
+      if(!m_blob.seek(m_blob.tell() - int(egptr() - gptr())))
+        return traits_type::eof();
+    }
+    setg(m_chunk.data(), m_chunk.data(), m_chunk.data());
+
+    if(!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+      setp(m_chunk.data(), m_chunk.data() + m_chunk.size());
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+
+  int blob_streambuf::sync(void)
+  {
+    return flush_chunk() ? 0 : -1;
+  }
+
+  blob_streambuf::pos_type blob_streambuf::seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which)
+  {
+    if(!flush_chunk())
+      return pos_type(off_type(-1));
+
+    off_type current = m_blob.tell() - (egptr() - gptr()); // account for the read ahead
+    off_type base = direction == std::ios_base::beg ? 0 :
+                    direction == std::ios_base::cur ? current :
+                                                      m_blob.size();
+    return seekpos(pos_type(base + offset), which);
+  }
+
+  blob_streambuf::pos_type blob_streambuf::seekpos(pos_type position, std::ios_base::openmode)
+  {
+    if(!flush_chunk() || !m_blob.seek(int(off_type(position))))
+      return pos_type(off_type(-1));
+    setg(m_chunk.data(), m_chunk.data(), m_chunk.data());
+    return position;
+  }
+
+#ifdef SQLITE_ENABLE_SESSION
+  changeset_conflict::changeset_conflict(int type, sqlite3_changeset_iter* iterator) noexcept
+    : m_type(type),
+      m_operation(0),
+      m_columns(0),
+      m_iterator(iterator)
+  {
+    const char* table = nullptr;
+    int indirect = 0;
+    if(sqlite3changeset_op(iterator, &table, &m_columns, &m_operation, &indirect) == SQLITE_OK && table != nullptr)
+      m_table = table;
+  }
+
+  namespace
+  {
+    struct apply_context
+    {
+      const conflict_handler& on_conflict;
+      const table_filter& filter;
+    };
+  }
+
+  bool db::applyChangeset(std::span<const std::byte> changes,
+                          const conflict_handler& on_conflict,
+                          const table_filter& filter) noexcept
+  {
+    apply_context context { on_conflict, filter };
+
+    auto filter_table = [](void* data, const char* table) noexcept -> int
+    {
+      const apply_context& self = *static_cast<const apply_context*>(data);
+      try { return self.filter(table) ? 1 : 0; }
+      catch(...) { return 0; }
+    };
+
+    auto resolve = [](void* data, int type, sqlite3_changeset_iter* iterator) noexcept -> int
+    {
+      const apply_context& self = *static_cast<const apply_context*>(data);
+      if(!self.on_conflict)
+        return SQLITE_CHANGESET_ABORT;
+      try
+      {
+        conflict_action action = self.on_conflict(changeset_conflict(type, iterator));
+        if(action == conflict_action::replace &&
+           type != SQLITE_CHANGESET_DATA && type != SQLITE_CHANGESET_CONFLICT)
+          return SQLITE_CHANGESET_ABORT; // SQLite treats this as misuse
+        return static_cast<int>(action);
+      }
+      catch(...) { return SQLITE_CHANGESET_ABORT; } // never unwind through SQLite
+    };
+
+    m_last_error = sqlite3changeset_apply(m_db,
+                                          int(changes.size()),
+                                          const_cast<std::byte*>(changes.data()),
+                                          filter ? +filter_table : nullptr,
+                                          resolve,
+                                          &context);
+    return m_last_error == SQLITE_OK;
+  }
+
+  session::session(void) noexcept
+    : m_session(nullptr),
+      m_db(nullptr),
+      m_last_error(SQLITE_OK)
+  {
+  }
+
+  session::~session(void) noexcept
+  {
+    close();
+  }
+
+  bool session::open(db& database, const std::string& schema) noexcept
+  {
+    close();
+    m_db = database.getHandle();
+    m_schema = schema;
+    m_last_error = sqlite3session_create(m_db, m_schema.c_str(), &m_session);
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool session::close(void) noexcept
+  {
+    if(m_session != nullptr)
+      sqlite3session_delete(m_session);
+    m_session = nullptr;
+    m_tables.clear();
+    return true;
+  }
+
+  bool session::attach(const std::string& table) noexcept
+  {
+    if(!valid())
+      return false;
+    m_last_error = sqlite3session_attach(m_session, table.empty() ? nullptr : table.c_str());
+    if(m_last_error != SQLITE_OK)
+      return false;
+    try { m_tables.push_back(table); }
+    catch(...) { m_last_error = SQLITE_NOMEM; }
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool session::enable(bool enabled) noexcept
+  {
+    return valid() && sqlite3session_enable(m_session, enabled ? 1 : 0) == (enabled ? 1 : 0);
+  }
+
+  bool session::collect(int (*generate)(sqlite3_session*, int*, void**), std::vector<uint8_t>& out) noexcept
+  {
+    out.clear();
+    if(!valid())
+      return false;
+
+    int size = 0;
+    void* data = nullptr;
+    m_last_error = generate(m_session, &size, &data);
+    if(m_last_error == SQLITE_OK)
+    {
+      try { out.assign(static_cast<uint8_t*>(data), static_cast<uint8_t*>(data) + size); }
+      catch(...) { m_last_error = SQLITE_NOMEM; }
+    }
+    sqlite3_free(data);
+    return m_last_error == SQLITE_OK;
+  }
+
+  bool session::changeset(std::vector<uint8_t>& out) noexcept
+    { return collect(sqlite3session_changeset, out); }
+
+  bool session::patchset(std::vector<uint8_t>& out) noexcept
+    { return collect(sqlite3session_patchset, out); }
+
+  // sessions can't be cleared, so a new one replaces it on the same tables
+  bool session::restart(void) noexcept
+  {
+    std::vector<std::string> tables = std::move(m_tables);
+    int enabled = sqlite3session_enable(m_session, -1);
+    sqlite3session_delete(m_session);
+    m_session = nullptr;
+    m_tables.clear();
+
+    m_last_error = sqlite3session_create(m_db, m_schema.c_str(), &m_session);
+    if(m_last_error != SQLITE_OK)
+      return false;
+    sqlite3session_enable(m_session, enabled);
+    for(const std::string& table : tables)
+      if(!attach(table))
+        return false;
+    return true;
+  }
+
+  bool session::takeChangeset(std::vector<uint8_t>& out) noexcept
+    { return changeset(out) && restart(); }
+
+  bool session::takePatchset(std::vector<uint8_t>& out) noexcept
+    { return patchset(out) && restart(); }
+#endif
+
+  namespace
+  {
+    // every block starts with a header so xFree/xSize know where it came from
+    struct alignas(16) block_header
+    {
+      uint64_t requested;
+      uint32_t size_class;
+    };
+    static_assert(sizeof(block_header) == 16, "header must keep 16 byte alignment");
+
+    constexpr uint32_t large_class = UINT32_MAX;
+    constexpr std::size_t smallest_block = 16;
+    constexpr std::size_t max_size_classes = 20;
+
+    struct free_block
+    {
+      free_block* next;
+    };
+
+    struct allocator_state
+    {
+      allocator_options options;
+      alignas(64) std::atomic<uint64_t> in_use { 0 };
+      alignas(64) std::atomic<uint64_t> requested { 0 };
+      alignas(64) std::atomic<uint64_t> high_water { 0 };
+      alignas(64) std::atomic<uint64_t> cached { 0 };
+      alignas(64) std::atomic<uint64_t> large { 0 };
+    } allocator;
+
+    struct thread_cache
+    {
+      std::array<free_block*, max_size_classes> heads {};
+      std::array<std::size_t, max_size_classes> counts {};
+
+      ~thread_cache(void) noexcept;
+    };
+
+    thread_local bool thread_cache_destroyed = false;
+    thread_local thread_cache local_blocks;
+
+    constexpr std::size_t class_size(uint32_t size_class) noexcept
+      { return smallest_block << size_class; }
+
+    constexpr uint32_t size_class_of(std::size_t size) noexcept
+      { return size <= smallest_block ? 0 : uint32_t(std::bit_width(size - 1) - std::bit_width(smallest_block - 1)); }
+
+    constexpr std::size_t usable_size(const block_header* header) noexcept
+      { return header->size_class == large_class ? (header->requested + 7) & ~std::size_t(7) : class_size(header->size_class); }
+
+    thread_cache::~thread_cache(void) noexcept
+    {
+      thread_cache_destroyed = true;
+      for(uint32_t size_class = 0; size_class < max_size_classes; ++size_class)
+        while(heads[size_class] != nullptr)
+        {
+          free_block* block = heads[size_class];
+          heads[size_class] = block->next;
+          allocator.cached.fetch_sub(class_size(size_class), std::memory_order_relaxed);
+          std::free(reinterpret_cast<block_header*>(block) - 1);
+        }
+    }
+
+    void* memory_malloc(int size) noexcept
+    {
+      std::size_t request = std::size_t(std::max(size, 1));
+      uint32_t size_class = request <= allocator.options.max_small_size ? size_class_of(request) : large_class;
+      block_header* header = nullptr;
+
+      if(size_class != large_class && !thread_cache_destroyed && local_blocks.heads[size_class] != nullptr)
+      {
+        free_block* block = local_blocks.heads[size_class];
+        local_blocks.heads[size_class] = block->next;
+        --local_blocks.counts[size_class];
+        allocator.cached.fetch_sub(class_size(size_class), std::memory_order_relaxed);
+        header = reinterpret_cast<block_header*>(block) - 1;
+      }
+      else
+      {
+        std::size_t bytes = size_class == large_class ? (request + 7) & ~std::size_t(7) : class_size(size_class);
+        header = static_cast<block_header*>(std::malloc(sizeof(block_header) + bytes));
+        if(header == nullptr)
+          return nullptr;
+        if(size_class == large_class)
+          allocator.large.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      header->requested = request;
+      header->size_class = size_class;
+
+      uint64_t in_use = allocator.in_use.fetch_add(usable_size(header), std::memory_order_relaxed) + usable_size(header);
+      allocator.requested.fetch_add(request, std::memory_order_relaxed);
+      uint64_t high_water = allocator.high_water.load(std::memory_order_relaxed);
+      while(in_use > high_water &&
+            !allocator.high_water.compare_exchange_weak(high_water, in_use, std::memory_order_relaxed));
+      return header + 1;
+    }
+
+    void memory_free(void* pointer) noexcept
+    {
+      if(pointer == nullptr)
+        return;
+
+      block_header* header = static_cast<block_header*>(pointer) - 1;
+      uint32_t size_class = header->size_class;
+      allocator.in_use.fetch_sub(usable_size(header), std::memory_order_relaxed);
+      allocator.requested.fetch_sub(header->requested, std::memory_order_relaxed);
+
+      if(size_class != large_class &&
+         !thread_cache_destroyed &&
+         local_blocks.counts[size_class] < allocator.options.cached_blocks)
+      {
+        free_block* block = reinterpret_cast<free_block*>(pointer);
+        block->next = local_blocks.heads[size_class];
+        local_blocks.heads[size_class] = block;
+        ++local_blocks.counts[size_class];
+        allocator.cached.fetch_add(class_size(size_class), std::memory_order_relaxed);
+        return;
+      }
+
+      if(size_class == large_class)
+        allocator.large.fetch_sub(1, std::memory_order_relaxed);
+      std::free(header);
+    }
+
+    int memory_size(void* pointer) noexcept
+    {
+      return pointer == nullptr ? 0 : int(usable_size(static_cast<block_header*>(pointer) - 1));
+    }
+
+    void* memory_realloc(void* pointer, int size) noexcept
+    {
+      block_header* header = static_cast<block_header*>(pointer) - 1;
+      std::size_t request = std::size_t(std::max(size, 1));
+      if(header->size_class != large_class && request <= class_size(header->size_class)) // still fits
+      {
+        allocator.requested.fetch_add(request - header->requested, std::memory_order_relaxed);
+        header->requested = request;
+        return pointer;
+      }
+
+      void* resized = memory_malloc(size);
+      if(resized != nullptr)
+      {
+        std::memcpy(resized, pointer, std::min<std::size_t>(usable_size(header), request));
+        memory_free(pointer);
+      }
+      return resized;
+    }
+
+    int memory_roundup(int size) noexcept
+    {
+      std::size_t request = std::size_t(std::max(size, 1));
+      return request <= allocator.options.max_small_size ? int(class_size(size_class_of(request)))
+                                                         : int((request + 7) & ~std::size_t(7));
+    }
+
+    int memory_init(void*) noexcept { return SQLITE_OK; }
+    void memory_shutdown(void*) noexcept { }
+  }
+
+  bool install_allocator(const allocator_options& options) noexcept
+  {
+    // the live allocator reads its options unsynchronized, they only change once SQLite
+    // has accepted the new methods, which it refuses after initialization
+    allocator_options clamped = options;
+    clamped.max_small_size = std::clamp<std::size_t>(options.max_small_size,
+                                                     smallest_block,
+                                                     class_size(max_size_classes - 1));
+
+    static const sqlite3_mem_methods methods =
+    {
+      memory_malloc,
+      memory_free,
+      memory_realloc,
+      memory_size,
+      memory_roundup,
+      memory_init,
+      memory_shutdown,
+      nullptr
+    };
+
+    if(sqlite3_config(SQLITE_CONFIG_MEMSTATUS, options.memstatus ? 1 : 0) != SQLITE_OK ||
+       sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) != SQLITE_OK)
+      return false;
+    allocator.options = clamped;
+    return true;
+  }
+
+  allocator_stats allocator_statistics(void) noexcept
+  {
+    return
+    {
+      allocator.in_use.load(std::memory_order_relaxed),
+      allocator.requested.load(std::memory_order_relaxed),
+      allocator.high_water.load(std::memory_order_relaxed),
+      allocator.cached.load(std::memory_order_relaxed),
+      allocator.large.load(std::memory_order_relaxed),
+    };
+  }
+
+  namespace
+  {
+    // lives at the start of every page slot, SQLite only sees the embedded sqlite3_pcache_page
+    struct page_entry
+    {
+      sqlite3_pcache_page page;
+      unsigned int key;
+      bool pinned;
+      bool from_arena;
+      uint32_t wasted;
+      page_entry* prev; // unpinned LRU list, most recent first
+      page_entry* next;
+    };
+
+    constexpr std::size_t entry_size = (sizeof(page_entry) + 15) & ~std::size_t(15);
+
+    struct page_cache
+    {
+      int page_size;
+      int extra_size;
+      bool purgeable;
+      unsigned int max_pages;
+      std::unordered_map<unsigned int, page_entry*> pages;
+      page_entry lru; // sentinel
+
+      page_cache(int page_bytes, int extra_bytes, bool can_purge) noexcept
+        : page_size(page_bytes), extra_size(extra_bytes), purgeable(can_purge), max_pages(100), lru()
+        { lru.prev = lru.next = &lru; }
+    };
+
+    struct arena_state
+    {
+      page_cache_options options;
+      std::unique_ptr<std::byte[]> arena;
+      std::mutex lock;
+      std::vector<std::byte*> free_slots;
+      std::size_t in_use = 0;
+      std::size_t high_water = 0;
+      std::atomic<std::size_t> heap_pages { 0 };
+      std::atomic<uint64_t> wasted { 0 };
+    } page_arena;
+
+    void lru_unlink(page_entry* entry) noexcept
+    {
+      entry->prev->next = entry->next;
+      entry->next->prev = entry->prev;
+      entry->prev = entry->next = nullptr;
+    }
+
+    void lru_push_front(page_cache* cache, page_entry* entry) noexcept
+    {
+      entry->next = cache->lru.next;
+      entry->prev = &cache->lru;
+      cache->lru.next->prev = entry;
+      cache->lru.next = entry;
+    }
+
+    page_entry* allocate_page(page_cache* cache) noexcept
+    {
+      std::size_t needed = entry_size + std::size_t(cache->page_size) + std::size_t(cache->extra_size);
+      std::byte* memory = nullptr;
+      bool from_arena = false;
+
+      if(needed <= page_arena.options.slot_size)
+      {
+        std::lock_guard<std::mutex> guard(page_arena.lock);
+        if(!page_arena.free_slots.empty())
+        {
+          memory = page_arena.free_slots.back();
+          page_arena.free_slots.pop_back();
+          page_arena.high_water = std::max(page_arena.high_water, ++page_arena.in_use);
+          from_arena = true;
+        }
+      }
+
+      if(memory == nullptr)
+      {
+        memory = static_cast<std::byte*>(std::malloc(needed));
+        if(memory == nullptr)
+          return nullptr;
+        page_arena.heap_pages.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      page_entry* entry = new(memory) page_entry();
+      entry->page.pBuf = memory + entry_size;
+      entry->page.pExtra = memory + entry_size + cache->page_size;
+      entry->from_arena = from_arena;
+      entry->wasted = from_arena ? uint32_t(page_arena.options.slot_size - needed) : 0;
+      page_arena.wasted.fetch_add(entry->wasted, std::memory_order_relaxed);
+      std::memset(entry->page.pExtra, 0, std::size_t(cache->extra_size));
+      return entry;
+    }
+
+    void free_page(page_entry* entry) noexcept
+    {
+      page_arena.wasted.fetch_sub(entry->wasted, std::memory_order_relaxed);
+      std::byte* memory = reinterpret_cast<std::byte*>(entry);
+      if(entry->from_arena)
+      {
+        std::lock_guard<std::mutex> guard(page_arena.lock);
+        page_arena.free_slots.push_back(memory);
+        --page_arena.in_use;
+      }
+      else
+      {
+        page_arena.heap_pages.fetch_sub(1, std::memory_order_relaxed);
+        std::free(memory);
+      }
+    }
+
+    void discard_page(page_cache* cache, page_entry* entry) noexcept
+    {
+      if(!entry->pinned)
+        lru_unlink(entry);
+      cache->pages.erase(entry->key);
+      free_page(entry);
+    }
+
+    void trim_cache(page_cache* cache, std::size_t limit) noexcept
+    {
+      while(cache->pages.size() > limit && cache->lru.prev != &cache->lru)
+        discard_page(cache, cache->lru.prev);
+    }
+
+    int pcache_init(void*) noexcept { return SQLITE_OK; }
+    void pcache_shutdown(void*) noexcept { }
+
+    sqlite3_pcache* pcache_create(int page_size, int extra_size, int purgeable) noexcept
+    {
+      return reinterpret_cast<sqlite3_pcache*>(new(std::nothrow) page_cache(page_size, extra_size, purgeable != 0));
+    }
+
+    void pcache_cachesize(sqlite3_pcache* handle, int pages) noexcept
+    {
+      page_cache* cache = reinterpret_cast<page_cache*>(handle);
+      cache->max_pages = unsigned(std::max(pages, 1));
+      if(cache->purgeable)
+        trim_cache(cache, cache->max_pages);
+    }
+
+    int pcache_pagecount(sqlite3_pcache* handle) noexcept
+    {
+      return int(reinterpret_cast<page_cache*>(handle)->pages.size());
+    }
+
+    sqlite3_pcache_page* pcache_fetch(sqlite3_pcache* handle, unsigned int key, int create) noexcept
+    {
+      page_cache* cache = reinterpret_cast<page_cache*>(handle);
+      auto found = cache->pages.find(key);
+      if(found != cache->pages.end())
+      {
+        page_entry* entry = found->second;
+        if(!entry->pinned)
+          lru_unlink(entry), entry->pinned = true;
+        return &entry->page;
+      }
+
+      if(create == 0)
+        return nullptr;
+
+      bool full = cache->pages.size() >= cache->max_pages;
+      bool have_unpinned = cache->lru.prev != &cache->lru;
+      if(create == 1 && full && !have_unpinned) // only allocate when it's easy
+        return nullptr;
+
+      page_entry* entry = nullptr;
+      if(cache->purgeable && full && have_unpinned) // recycle the least recently used page
+      {
+        entry = cache->lru.prev;
+        lru_unlink(entry);
+        cache->pages.erase(entry->key);
+        std::memset(entry->page.pExtra, 0, std::size_t(cache->extra_size));
+      }
+      else if((entry = allocate_page(cache)) == nullptr)
+        return nullptr;
+
+      entry->key = key;
+      entry->pinned = true;
+      try { cache->pages.emplace(key, entry); }
+      catch(...) { free_page(entry); return nullptr; }
+      return &entry->page;
+    }
+
+    void pcache_unpin(sqlite3_pcache* handle, sqlite3_pcache_page* page, int discard) noexcept
+    {
+      page_cache* cache = reinterpret_cast<page_cache*>(handle);
+      page_entry* entry = reinterpret_cast<page_entry*>(page);
+      entry->pinned = false;
+
+      if(discard != 0)
+      {
+        cache->pages.erase(entry->key);
+        free_page(entry);
+        return;
+      }
+
+      lru_push_front(cache, entry);
+      if(cache->purgeable)
+        trim_cache(cache, cache->max_pages);
+    }
+
+    void pcache_rekey(sqlite3_pcache* handle, sqlite3_pcache_page* page, unsigned int old_key, unsigned int new_key) noexcept
+    {
+      page_cache* cache = reinterpret_cast<page_cache*>(handle);
+      page_entry* entry = reinterpret_cast<page_entry*>(page);
+
+      auto existing = cache->pages.find(new_key); // guaranteed to be unpinned
+      if(existing != cache->pages.end())
+        discard_page(cache, existing->second);
+
+      cache->pages.erase(old_key);
+      entry->key = new_key;
+      cache->pages.emplace(new_key, entry);
+    }
+
+    void pcache_truncate(sqlite3_pcache* handle, unsigned int limit) noexcept
+    {
+      page_cache* cache = reinterpret_cast<page_cache*>(handle);
+      for(auto pos = cache->pages.begin(); pos != cache->pages.end();)
+      {
+        page_entry* entry = pos->second;
+        if(entry->key < limit)
+        {
+          ++pos;
+          continue;
+        }
+        if(!entry->pinned)
+          lru_unlink(entry);
+        pos = cache->pages.erase(pos);
+        free_page(entry);
+      }
+    }
+
+    void pcache_destroy(sqlite3_pcache* handle) noexcept
+    {
+      page_cache* cache = reinterpret_cast<page_cache*>(handle);
+      for(auto& entry : cache->pages)
+        free_page(entry.second);
+      delete cache;
+    }
+
+    void pcache_shrink(sqlite3_pcache* handle) noexcept
+    {
+      trim_cache(reinterpret_cast<page_cache*>(handle), 0);
+    }
+  }
+
+  bool install_page_cache(const page_cache_options& options) noexcept
+  {
+    std::size_t slot_size = (std::max(options.slot_size, entry_size + 512) + 15) & ~std::size_t(15);
+    std::unique_ptr<std::byte[]> arena(new(std::nothrow) std::byte[slot_size * options.slots]);
+    if(arena == nullptr && options.slots != 0)
+      return false;
+
+    static const sqlite3_pcache_methods2 methods =
+    {
+      1,
+      nullptr,
+      pcache_init,
+      pcache_shutdown,
+      pcache_create,
+      pcache_cachesize,
+      pcache_pagecount,
+      pcache_fetch,
+      pcache_unpin,
+      pcache_rekey,
+      pcache_truncate,
+      pcache_destroy,
+      pcache_shrink
+    };
+
+    if(sqlite3_config(SQLITE_CONFIG_PCACHE2, &methods) != SQLITE_OK)
+      return false;
+
+    std::lock_guard<std::mutex> guard(page_arena.lock);
+    page_arena.options = options;
+    page_arena.options.slot_size = slot_size;
+    page_arena.arena = std::move(arena);
+    page_arena.free_slots.clear();
+    page_arena.free_slots.reserve(options.slots);
+    for(std::size_t slot = options.slots; slot-- > 0;) // hand out low addresses first
+      page_arena.free_slots.push_back(page_arena.arena.get() + slot * slot_size);
+    return true;
+  }
+
+  page_cache_stats page_cache_statistics(void) noexcept
+  {
+    std::lock_guard<std::mutex> guard(page_arena.lock);
+    return
+    {
+      page_arena.options.slot_size,
+      page_arena.options.slots,
+      page_arena.in_use,
+      page_arena.high_water,
+      page_arena.heap_pages.load(std::memory_order_relaxed),
+      page_arena.wasted.load(std::memory_order_relaxed),
+    };
   }
 }
@@ -2,10 +2,36 @@
 #define SIMPLE_SQLITE_H
 
 #include <sqlite3.h>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iosfwd>
+#include <list>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <streambuf>
 #include <string>
 #include <string_view>
 #include <optional>
+#include <iterator>
+#include <latch>
+#include <limits>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 
@@ -33,26 +59,771 @@ namespace sql
       std::is_same_v<T, std::u16string> ||
       std::is_same_v<T, std::vector<uint8_t>>> {};
 
+  // views point into the column buffer and are only valid until the next fetchRow()
+  template< class T >
+  struct is_sql_view : std::integral_constant<bool,
+      std::is_same_v<T, std::string_view> ||
+      std::is_same_v<T, std::u16string_view> ||
+      std::is_same_v<T, std::span<const std::byte>>> {};
+
   class query;
 
+  // process wide memory configuration, only effective before the first db::open()
+  struct allocator_options
+  {
+    std::size_t max_small_size = 4096; // larger requests go straight to malloc
+    std::size_t cached_blocks = 256; // per size class and thread
+    bool memstatus = false; // SQLite's own accounting takes a global mutex on every allocation
+  };
+
+  struct allocator_stats
+  {
+    uint64_t bytes_in_use; // rounded up to the size class
+    uint64_t bytes_requested;
+    uint64_t high_water;
+    uint64_t bytes_cached; // free blocks held by thread caches
+    uint64_t large_allocations;
+
+    double fragmentation(void) const noexcept
+      { return bytes_in_use ? 1.0 - double(bytes_requested) / double(bytes_in_use) : 0.0; }
+  };
+
+  struct page_cache_options
+  {
+    std::size_t slot_size = 4096 + 512; // page plus SQLite's per page extra data
+    std::size_t slots = 4096;
+  };
+
+  struct page_cache_stats
+  {
+    std::size_t slot_size;
+    std::size_t slots;
+    std::size_t slots_in_use;
+    std::size_t high_water;
+    std::size_t heap_pages; // pages that didn't fit in the arena
+    uint64_t wasted_bytes; // unused space inside slots in use
+
+    double fragmentation(void) const noexcept
+      { return slots_in_use ? double(wasted_bytes) / double(slots_in_use * slot_size) : 0.0; }
+  };
+
+  // thread-local size class pools for SQLITE_CONFIG_MALLOC
+  bool install_allocator(const allocator_options& options = allocator_options()) noexcept;
+  allocator_stats allocator_statistics(void) noexcept;
+
+  // SQLITE_CONFIG_PCACHE2 backed by a single preallocated arena of page slots
+  bool install_page_cache(const page_cache_options& options = page_cache_options()) noexcept;
+  page_cache_stats page_cache_statistics(void) noexcept;
+
+  // binds a blob of zeros so the row can be filled in afterwards with a blob_stream
+  struct zeroblob
+  {
+    sqlite3_uint64 size;
+  };
+
+  template< class T >
+  struct is_sql_arg : std::integral_constant<bool,
+      is_sql_type<T>::value ||
+      is_string_view<T>::value ||
+      is_sql_view<T>::value ||
+      std::is_same_v<T, zeroblob>> {};
+
+  struct batch_options
+  {
+    std::size_t chunk_size = 1000; // rows per transaction, zero for a single transaction
+    // a failed chunk is rolled back and the batch continues; chunks run inside an already
+    // open transaction are always savepoints, committed or rolled back along with it
+    bool savepoint_per_chunk = false;
+  };
+
+  template< class T >
+  struct is_tuple_like : std::false_type {};
+
+  template< class... Ts >
+  struct is_tuple_like<std::tuple<Ts...>> : std::true_type {};
+
+  template< class T1, class T2 >
+  struct is_tuple_like<std::pair<T1, T2>> : std::true_type {};
+
+  namespace detail
+  {
+    struct any_field
+    {
+      template <typename T>
+      operator T(void) const;
+    };
+
+    template <typename T, std::size_t... I>
+    constexpr bool brace_constructible(std::index_sequence<I...>)
+      { return requires { T{ (void(I), any_field{})... }; }; }
+
+    template <typename T, std::size_t N = 0>
+    constexpr std::size_t aggregate_arity(void)
+    {
+      if constexpr (brace_constructible<T>(std::make_index_sequence<N + 1>()))
+        return aggregate_arity<T, N + 1>();
+      else
+        return N;
+    }
+
+    // references to every member of a plain aggregate in declaration order
+    template <typename T>
+    constexpr auto tie_members(T& row) noexcept
+    {
+      constexpr std::size_t arity = aggregate_arity<std::remove_const_t<T>>();
+      static_assert(arity > 0 && arity <= 16, "aggregates must have between 1 and 16 members");
+      if constexpr (arity == 1) { auto& [m0] = row; return std::tie(m0); }
+      else if constexpr (arity == 2) { auto& [m0, m1] = row; return std::tie(m0, m1); }
+      else if constexpr (arity == 3) { auto& [m0, m1, m2] = row; return std::tie(m0, m1, m2); }
+      else if constexpr (arity == 4) { auto& [m0, m1, m2, m3] = row; return std::tie(m0, m1, m2, m3); }
+      else if constexpr (arity == 5) { auto& [m0, m1, m2, m3, m4] = row; return std::tie(m0, m1, m2, m3, m4); }
+      else if constexpr (arity == 6) { auto& [m0, m1, m2, m3, m4, m5] = row; return std::tie(m0, m1, m2, m3, m4, m5); }
+      else if constexpr (arity == 7) { auto& [m0, m1, m2, m3, m4, m5, m6] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6); }
+      else if constexpr (arity == 8) { auto& [m0, m1, m2, m3, m4, m5, m6, m7] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6, m7); }
+      else if constexpr (arity == 9) { auto& [m0, m1, m2, m3, m4, m5, m6, m7, m8] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6, m7, m8); }
+      else if constexpr (arity == 10) { auto& [m0, m1, m2, m3, m4, m5, m6, m7, m8, m9] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9); }
+      else if constexpr (arity == 11) { auto& [m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10); }
+      else if constexpr (arity == 12) { auto& [m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11); }
+      else if constexpr (arity == 13) { auto& [m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12); }
+      else if constexpr (arity == 14) { auto& [m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13); }
+      else if constexpr (arity == 15) { auto& [m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14); }
+      else if constexpr (arity == 16) { auto& [m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15] = row; return std::tie(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15); }
+    }
+  }
+
+  // plain structs are bound and fetched member by member, in declaration order
+  template< class T >
+  struct is_sql_aggregate : std::integral_constant<bool,
+      std::is_class_v<T> &&
+      std::is_aggregate_v<T> &&
+      !is_tuple_like<T>::value &&
+      !is_sql_arg<T>::value> {};
+
+  template< class T >
+  struct is_sql_row : std::integral_constant<bool,
+      is_tuple_like<T>::value ||
+      is_sql_aggregate<T>::value> {};
+
+  template< class... Ts >
+  struct row_type { using type = std::tuple<Ts...>; };
+
+  template< class T >
+  struct row_type<T> { using type = T; };
+
+  // a range over a temporary query takes ownership of it so it outlives the range-for
+  template <typename Row, typename Source = query&>
+  class row_range;
+
+  // keeps column buffers on cache line boundaries so they can be fed to aligned SIMD loads
+  template <typename T, std::size_t Alignment = 64>
+  struct aligned_allocator
+  {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = aligned_allocator<U, Alignment>; };
+
+    aligned_allocator(void) noexcept = default;
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Alignment>&) noexcept { }
+
+    T* allocate(std::size_t count)
+      { return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment))); }
+
+    void deallocate(T* pointer, std::size_t) noexcept
+      { ::operator delete(pointer, std::align_val_t(Alignment)); }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U, Alignment>&) const noexcept { return true; }
+  };
+
+  template <typename T>
+  using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+  // Arrow style validity bitmap shared by every column buffer: a set bit means not NULL
+  class column_base
+  {
+    friend class query;
+  public:
+    constexpr std::size_t size(void) const noexcept { return m_rows; }
+    bool isNull(std::size_t row) const noexcept { return !((m_validity[row / 64] >> (row % 64)) & 1); }
+    const uint64_t* validity(void) const noexcept { return m_validity.data(); }
+
+  protected:
+    void reserve_rows(std::size_t rows) { m_validity.reserve((rows + 63) / 64); }
+    void clear_rows(void) noexcept { m_validity.clear(); m_rows = 0; }
+
+    void push_validity(bool valid)
+    {
+      if(m_rows % 64 == 0)
+        m_validity.push_back(0);
+      m_validity.back() |= uint64_t(valid) << (m_rows % 64);
+      ++m_rows;
+    }
+
+    aligned_vector<uint64_t> m_validity;
+    std::size_t m_rows = 0;
+  };
+
+  // fixed width values, NULL rows hold a zero value
+  template <typename T>
+  class column : public column_base
+  {
+    friend class query;
+    static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>, "use column<std::string_view> or column<std::span<const std::byte>> for variable length data");
+  public:
+    void reserve(std::size_t rows) { reserve_rows(rows); m_values.reserve(rows); }
+    void clear(void) noexcept { clear_rows(); m_values.clear(); }
+
+    const T* data(void) const noexcept { return m_values.data(); }
+    T operator[](std::size_t row) const noexcept { return m_values[row]; }
+
+  private:
+    aligned_vector<T> m_values;
+  };
+
+  // variable length values packed end to end in one arena, row N spans offsets[N] to offsets[N + 1]
+  template <typename Element, typename View>
+  class arena_column : public column_base
+  {
+    friend class query;
+  public:
+    arena_column(void) : m_offsets(1, 0) { }
+
+    void reserve(std::size_t rows, std::size_t bytes) { reserve_rows(rows); m_offsets.reserve(rows + 1); m_data.reserve(bytes); }
+    void clear(void) noexcept { clear_rows(); m_offsets.resize(1); m_data.clear(); }
+
+    const uint64_t* offsets(void) const noexcept { return m_offsets.data(); }
+    const Element* data(void) const noexcept { return m_data.data(); }
+    View operator[](std::size_t row) const noexcept
+      { return View(m_data.data() + m_offsets[row], m_offsets[row + 1] - m_offsets[row]); }
+
+  private:
+    aligned_vector<uint64_t> m_offsets;
+    aligned_vector<Element> m_data;
+  };
+
+  template <>
+  class column<std::string_view> : public arena_column<char, std::string_view> { };
+
+  template <>
+  class column<std::span<const std::byte>> : public arena_column<std::byte, std::span<const std::byte>> { };
+
+  // counters for one finished execution of a statement
+  struct statement_execution
+  {
+    std::string_view sql; // normalized, literals replaced with '?'
+    uint64_t elapsed_ns;
+    uint64_t rows;
+    uint64_t vm_steps;
+    uint64_t fullscan_steps;
+    uint64_t sorts;
+    uint64_t autoindexes;
+  };
+
+  // totals for every execution of one normalized statement
+  struct statement_profile
+  {
+    std::string sql;
+    uint64_t calls;
+    uint64_t rows;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t vm_steps;
+    uint64_t fullscan_steps;
+    uint64_t sorts;
+    uint64_t autoindexes;
+    std::array<uint64_t, 32> latency_histogram; // bucket N counts runs under 2^N microseconds
+  };
+
+  struct backup_options
+  {
+    int pages_per_step = 64; // the source is only locked while a step runs
+    std::chrono::milliseconds step_pause { 0 }; // gives writers a window between steps
+    std::chrono::milliseconds busy_timeout { 5000 }; // total wait on a locked source before failing with SQLITE_BUSY
+    std::function<bool(int remaining, int total)> progress; // return false to abort
+  };
+
+  // flags for user defined functions, combine with |
+  enum function_flag : int
+  {
+    deterministic = SQLITE_DETERMINISTIC, // same inputs give the same result, allows constant folding and use in indexes
+    innocuous = SQLITE_INNOCUOUS, // no side effects, usable from triggers and views in untrusted schemas
+    direct_only = SQLITE_DIRECTONLY, // only callable from top level SQL
+  };
+
+  namespace detail
+  {
+    template <typename T>
+    struct remove_optional { using type = T; };
+
+    template <typename T>
+    struct remove_optional<std::optional<T>> { using type = T; };
+
+    template <typename T>
+    struct is_function_value : std::integral_constant<bool,
+        is_sql_type<typename remove_optional<T>::type>::value ||
+        is_sql_view<typename remove_optional<T>::type>::value> {};
+
+    // argument and result types of anything std::function can be deduced from
+    template <typename F>
+    struct signature;
+
+    template <typename R, typename... Args>
+    struct signature<std::function<R(Args...)>>
+    {
+      using result = R;
+      using arguments = std::tuple<std::decay_t<Args>...>;
+    };
+
+    template <typename F>
+    using signature_of = signature<decltype(std::function { std::declval<F>() })>;
+
+    template <typename M>
+    struct member_signature;
+
+    template <typename R, typename C, typename... Args>
+    struct member_signature<R (C::*)(Args...)> { using arguments = std::tuple<std::decay_t<Args>...>; };
+
+    template <typename R, typename C, typename... Args>
+    struct member_signature<R (C::*)(Args...) noexcept> { using arguments = std::tuple<std::decay_t<Args>...>; };
+
+    // SQLite speaks UTF-8 and UTF-16, wchar_t is UTF-16 on Windows but UTF-32 elsewhere
+    inline std::wstring wstring_from_utf16(std::u16string_view text)
+    {
+      if constexpr (sizeof(wchar_t) == sizeof(char16_t))
+        return std::wstring(reinterpret_cast<const wchar_t*>(text.data()), text.size());
+      else
+      {
+        std::wstring result;
+        result.reserve(text.size());
+        for(std::size_t pos = 0; pos < text.size(); ++pos)
+        {
+          char32_t unit = text[pos];
+          if(unit >= 0xD800 && unit < 0xDC00 && pos + 1 < text.size() && text[pos + 1] >= 0xDC00 && text[pos + 1] < 0xE000)
+            unit = 0x10000 + ((unit - 0xD800) << 10) + (text[++pos] - 0xDC00);
+          result.push_back(wchar_t(unit));
+        }
+        return result;
+      }
+    }
+
+    inline std::u16string utf16_from_wstring(std::wstring_view text)
+    {
+      if constexpr (sizeof(wchar_t) == sizeof(char16_t))
+        return std::u16string(reinterpret_cast<const char16_t*>(text.data()), text.size());
+      else
+      {
+        std::u16string result;
+        result.reserve(text.size());
+        for(wchar_t character : text)
+        {
+          char32_t code = char32_t(character);
+          if(code > 0x10FFFF)
+            result.push_back(u'\uFFFD');
+          else if(code >= 0x10000)
+          {
+            result.push_back(char16_t(0xD800 + ((code - 0x10000) >> 10)));
+            result.push_back(char16_t(0xDC00 + ((code - 0x10000) & 0x3FF)));
+          }
+          else
+            result.push_back(char16_t(code));
+        }
+        return result;
+      }
+    }
+
+    // values are converted the way SQLite's own casts would, NULL only maps to std::optional
+    template <typename T>
+    T from_value(sqlite3_value* value)
+    {
+      if constexpr (std::is_same_v<T, std::optional<typename remove_optional<T>::type>>)
+      {
+        if(sqlite3_value_type(value) == SQLITE_NULL)
+          return std::nullopt;
+        return from_value<typename remove_optional<T>::type>(value);
+      }
+      else if constexpr (std::is_enum_v<T>)
+        return T(sqlite3_value_int64(value));
+      else if constexpr (std::is_integral_v<T>)
+        return T(sqlite3_value_int64(value));
+      else if constexpr (std::is_floating_point_v<T>)
+        return T(sqlite3_value_double(value));
+      else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>)
+      {
+        const char* text = reinterpret_cast<const char*>(sqlite3_value_text(value));
+        return text == nullptr ? T() : T(text, sqlite3_value_bytes(value));
+      }
+      else if constexpr (std::is_same_v<T, std::u16string> || std::is_same_v<T, std::u16string_view>)
+      {
+        const char16_t* text = static_cast<const char16_t*>(sqlite3_value_text16(value));
+        return text == nullptr ? T() : T(text, sqlite3_value_bytes16(value) / sizeof(char16_t));
+      }
+      else if constexpr (std::is_same_v<T, std::wstring>)
+      {
+        const char16_t* text = static_cast<const char16_t*>(sqlite3_value_text16(value));
+        return text == nullptr ? T() : wstring_from_utf16(std::u16string_view(text, sqlite3_value_bytes16(value) / sizeof(char16_t)));
+      }
+      else // blobs
+      {
+        const std::byte* data = static_cast<const std::byte*>(sqlite3_value_blob(value));
+        std::size_t size = sqlite3_value_bytes(value);
+        if constexpr (std::is_same_v<T, std::vector<uint8_t>>)
+          return data == nullptr ? T() : T(reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + size);
+        else
+          return T(data, data == nullptr ? 0 : size);
+      }
+    }
+
+    // SQLITE_STATIC may be passed when the value outlives the statement step
+    template <typename T>
+    void set_result(sqlite3_context* context, const T& value, sqlite3_destructor_type destructor = SQLITE_TRANSIENT)
+    {
+      if constexpr (std::is_same_v<T, std::optional<typename remove_optional<T>::type>>)
+      {
+        if(value.has_value())
+          set_result(context, *value, destructor);
+        else
+          sqlite3_result_null(context);
+      }
+      else if constexpr (std::is_same_v<T, bool>)
+        sqlite3_result_int(context, value);
+      else if constexpr (std::is_enum_v<T>)
+        sqlite3_result_int64(context, static_cast<std::underlying_type_t<T>>(value));
+      else if constexpr (std::is_integral_v<T>)
+        sqlite3_result_int64(context, value);
+      else if constexpr (std::is_floating_point_v<T>)
+        sqlite3_result_double(context, value);
+      else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>)
+        sqlite3_result_text64(context, value.data(), value.size(), destructor, SQLITE_UTF8);
+      else if constexpr (std::is_same_v<T, std::u16string> || std::is_same_v<T, std::u16string_view>)
+        sqlite3_result_text16(context, value.data(), value.size() * sizeof(char16_t), destructor);
+      else if constexpr (std::is_same_v<T, std::wstring>)
+      {
+        if constexpr (sizeof(wchar_t) == sizeof(char16_t))
+          sqlite3_result_text16(context, value.data(), value.size() * sizeof(char16_t), destructor);
+        else
+        {
+          std::u16string text = utf16_from_wstring(value);
+          sqlite3_result_text16(context, text.data(), text.size() * sizeof(char16_t), SQLITE_TRANSIENT);
+        }
+      }
+      else // blobs
+        sqlite3_result_blob64(context, value.data(), value.size(), destructor);
+    }
+
+    template <typename Tuple, std::size_t... I>
+    Tuple from_values(sqlite3_value** values, std::index_sequence<I...>)
+      { return Tuple { from_value<std::tuple_element_t<I, Tuple>>(values[I])... }; }
+
+    // exceptions must not unwind through SQLite, they become the statement's error
+    template <typename Body>
+    void guarded_call(sqlite3_context* context, Body&& body) noexcept
+    {
+      try { body(); }
+      catch(const std::string& error) { sqlite3_result_error(context, error.data(), error.size()); }
+      catch(const std::bad_alloc&) { sqlite3_result_error_nomem(context); }
+      catch(const std::exception& error) { sqlite3_result_error(context, error.what(), -1); }
+      catch(...) { sqlite3_result_error(context, "unknown exception in user function", -1); }
+    }
+
+    // the aggregate context only holds a pointer so State can be any C++ type
+    // it's null until the first row, so value() of an empty group uses a fresh State
+    template <typename State>
+    struct aggregate
+    {
+      using arguments = typename member_signature<decltype(&State::step)>::arguments;
+      using result = std::decay_t<decltype(std::declval<State&>().value())>;
+      static constexpr std::size_t arity = std::tuple_size_v<arguments>;
+
+      static State*& slot(sqlite3_context* context)
+      {
+        State** state = static_cast<State**>(sqlite3_aggregate_context(context, sizeof(State*)));
+        if(state == nullptr)
+          throw std::bad_alloc();
+        return *state;
+      }
+
+      static State& state(sqlite3_context* context)
+      {
+        State*& state = slot(context);
+        if(state == nullptr)
+          state = new State();
+        return *state;
+      }
+
+      static void step(sqlite3_context* context, int, sqlite3_value** values) noexcept
+      {
+        guarded_call(context, [&]
+        {
+          State& target = state(context);
+          std::apply([&](auto&&... args) { target.step(std::move(args)...); },
+                     from_values<arguments>(values, std::make_index_sequence<arity>()));
+        });
+      }
+
+      static void inverse(sqlite3_context* context, int, sqlite3_value** values) noexcept
+      {
+        guarded_call(context, [&]
+        {
+          State& target = state(context);
+          std::apply([&](auto&&... args) { target.inverse(std::move(args)...); },
+                     from_values<arguments>(values, std::make_index_sequence<arity>()));
+        });
+      }
+
+      static void value(sqlite3_context* context) noexcept
+      {
+        guarded_call(context, [&] { set_result(context, result(state(context).value())); });
+      }
+
+      static void final(sqlite3_context* context) noexcept
+      {
+        State** state = static_cast<State**>(sqlite3_aggregate_context(context, 0));
+        std::unique_ptr<State> owned(state != nullptr ? *state : nullptr);
+        guarded_call(context, [&]
+        {
+          if(owned == nullptr)
+            owned.reset(new State());
+          set_result(context, result(owned->value()));
+        });
+      }
+    };
+  }
+
+#ifdef SQLITE_ENABLE_SESSION
+  // change capture through the session extension, needs SQLite built with
+  // SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK and the same defines here
+  enum class conflict_action : int
+  {
+    omit = SQLITE_CHANGESET_OMIT, // skip the change
+    replace = SQLITE_CHANGESET_REPLACE, // overwrite, only for data and conflict types
+    abort = SQLITE_CHANGESET_ABORT, // roll back the whole apply
+  };
+
+  class changeset_conflict;
+  using conflict_handler = std::function<conflict_action(const changeset_conflict&)>;
+  using table_filter = std::function<bool(std::string_view table)>;
+#endif
+
+  // sinks take every byte or return false, sources fill up to the size of the buffer
+  // and return the number of bytes written to it, zero at the end of the input
+  using byte_sink = std::function<bool(std::span<const std::byte> data)>;
+  using byte_source = std::function<std::size_t(std::span<std::byte> buffer)>;
+
+  byte_sink ostream_sink(std::ostream& out);
+  byte_source istream_source(std::istream& in);
+
+  // binary: "SQLR", a version byte, a varint column count and the column names as
+  // varint length prefixed UTF-8, then per row one tagged value per column; the tag is
+  // the SQLITE_* type followed by a zigzag varint integer, a little endian double,
+  // or a varint length and the bytes of text and blobs, nothing for NULL
+  // csv: RFC 4180 with a header row, NULL is an empty unquoted field, blobs are X'hex' literals
+  // and numbers are unquoted, reals always with a fraction or exponent; text is quoted whenever
+  // it would read back as one of those, so exported rows import with the types they had
+  enum class stream_format
+  {
+    binary,
+    csv,
+  };
+
+  struct stream_options
+  {
+    stream_format format = stream_format::binary;
+    std::size_t buffer_size = 64 * 1024; // memory used for buffering either way
+    std::size_t chunk_rows = 10000; // rows per import transaction
+  };
+
+  class db;
+
+  // writes the remaining rows of a query, returns the number of rows written
+  std::size_t export_stream(query& source, const byte_sink& sink, const stream_options& options = stream_options());
+
+  // inserts every row into table matching columns by name, through one reused prepared
+  // statement and a transaction (or a savepoint inside one) every chunk_rows rows
+  // returns the number of rows committed; errors throw after rolling back the current chunk
+  std::size_t import_stream(db& target, const byte_source& source, const std::string_view& table, const stream_options& options = stream_options());
+
+  struct cache_stats
+  {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  // reported instead of SQLITE_INTERRUPT when a deadline expires, an extended code
+  // SQLite doesn't use itself so (error & 0xff) is still SQLITE_INTERRUPT
+  constexpr int timed_out = SQLITE_INTERRUPT | (0xff << 8);
+
+  // retries a locked database with exponential backoff instead of failing with SQLITE_BUSY
+  struct busy_policy
+  {
+    std::chrono::microseconds initial_delay { 100 };
+    std::chrono::microseconds max_delay { 50000 };
+    std::chrono::milliseconds max_wait { 5000 }; // SQLITE_BUSY is returned after waiting this long
+    double multiplier = 2.0;
+    double jitter = 0.5; // each delay is randomly shortened by up to this fraction
+    bool immediate_transactions = false; // BEGIN takes the write lock up front, see db::execute()
+  };
+
+  struct lock_wait_stats
+  {
+    uint64_t waits;
+    uint64_t retries;
+    uint64_t timeouts; // waits that gave up with SQLITE_BUSY
+    uint64_t total_ns;
+    uint64_t max_ns;
+    std::array<uint64_t, 32> histogram; // bucket N counts waits under 2^N microseconds
+  };
+
+  struct deadline_stats
+  {
+    uint64_t armed; // steps run with a deadline
+    uint64_t checks; // progress handler calls
+    uint64_t timeouts;
+  };
+
   class db
   {
+    friend class query;
   public:
     db(void) noexcept;
     ~db(void) noexcept;
 
+    db(const db&) = delete;
+    db& operator=(const db&) = delete;
+
     constexpr int lastError(void) const noexcept { return m_last_error; }
     constexpr void clearError(void) noexcept { m_last_error = SQLITE_OK; }
 
     bool open(const std::string_view& filename) noexcept;
+    bool open(const std::string_view& filename, int flags) noexcept;
     bool close(void) noexcept;
 
     query build_query(const std::string_view& query_str);
     bool execute(const std::string_view& sql_str) noexcept;
 
+    constexpr sqlite3* getHandle(void) noexcept { return m_db; }
+    int64_t lastInsertRowId(void) const noexcept { return sqlite3_last_insert_rowid(m_db); }
+
+    // statement profiling through sqlite3_trace_v2, nothing is registered while disabled
+    // the callback, if any, is invoked after every statement execution
+    using profile_callback = std::function<void(const statement_execution&)>;
+    bool enableProfiling(profile_callback callback = nullptr) noexcept;
+    void disableProfiling(void) noexcept;
+    void resetProfiling(void) noexcept;
+    std::vector<statement_profile> profileSnapshot(void) const;
+
+    // statements running longer than timeout fail with sql::timed_out, zero disables
+    // the clock starts at a statement's first step and is checked every granularity VM
+    // instructions; query::setDeadline() overrides it for a single query
+    void setTimeout(std::chrono::nanoseconds timeout) noexcept { m_timeout = timeout; }
+    void setDeadlineGranularity(int instructions) noexcept;
+    constexpr const deadline_stats& deadlineStats(void) const noexcept { return m_deadline_stats; }
+
+    // with immediate_transactions a plain or deferred BEGIN passed to execute(), and the
+    // transactions of executeBatch(), start as BEGIN IMMEDIATE so a reader never has to
+    // upgrade to a writer, which fails with SQLITE_BUSY without consulting the handler
+    void setBusyPolicy(const busy_policy& policy) noexcept;
+    void clearBusyPolicy(void) noexcept;
+    constexpr const lock_wait_stats& lockWaitStats(void) const noexcept { return m_lock_wait_stats; }
+    void resetLockWaitStats(void) noexcept { m_lock_wait_stats = lock_wait_stats {}; }
+
+    // aborts whatever this connection is running, safe to call from any thread
+    void interrupt(void) noexcept { sqlite3_interrupt(m_db); }
+
+    // online copies through the sqlite3_backup API, a few pages at a time so the
+    // source stays usable; the copy restarts by itself if another connection writes
+    bool snapshot_to(const std::string_view& filename, const backup_options& options = backup_options()) noexcept;
+    bool snapshot_to(db& destination, const backup_options& options = backup_options()) noexcept;
+
+    // replaces this connection with an in-memory copy of its own database or of another file
+    // the swap only happens once the copy is complete, queries still checked out keep
+    // working against the old connection until they are destroyed
+    bool load_into_memory(const backup_options& options = backup_options()) noexcept;
+    bool load_into_memory(const std::string_view& filename, const backup_options& options = backup_options()) noexcept;
+
+    // native SQL functions, argument and result types are deduced from f and marshalled at
+    // compile time; string views and spans passed in are only valid during the call
+    // registrations belong to the current connection and aren't carried over by load_into_memory()
+    template <typename F>
+    bool register_function(const std::string_view& name, F&& f, int flags = 0) noexcept;
+
+    // State is default constructed per group and needs step(args...) and value()
+    // adding inverse(args...) makes it usable as an aggregate window function
+    template <typename State>
+    bool register_aggregate(const std::string_view& name, int flags = 0) noexcept;
+
+#ifdef SQLITE_ENABLE_SESSION
+    // applies a changeset or patchset from a session in a single transaction
+    // without a handler any conflict aborts it
+    bool applyChangeset(std::span<const std::byte> changes,
+                        const conflict_handler& on_conflict = nullptr,
+                        const table_filter& filter = nullptr) noexcept;
+    bool applyChangeset(const std::vector<uint8_t>& changes,
+                        const conflict_handler& on_conflict = nullptr,
+                        const table_filter& filter = nullptr) noexcept
+      { return applyChangeset(std::as_bytes(std::span(changes)), on_conflict, filter); }
+#endif
+
+    // prepared statements are kept in an LRU cache keyed by their SQL text
+    // a capacity of zero disables caching
+    void setStatementCacheSize(std::size_t capacity) noexcept;
+    void clearStatementCache(void) noexcept;
+    constexpr std::size_t statementCacheSize(void) const noexcept { return m_cache_capacity; }
+    constexpr const cache_stats& statementCacheStats(void) const noexcept { return m_cache_stats; }
+
   private:
+    struct cached_statement
+    {
+      std::string sql;
+      sqlite3_stmt* statement;
+    };
+    using cache_list = std::list<cached_statement>;
+
+    sqlite3_stmt* checkout(const std::string_view& query_str, std::string& key) noexcept;
+    void checkin(sqlite3_stmt* statement, std::string&& key) noexcept;
+    void evict(cache_list::iterator pos) noexcept;
+
+    int copy_database(sqlite3* source, sqlite3* destination, const backup_options& options) noexcept;
+    void arm_deadline(std::chrono::steady_clock::time_point deadline) noexcept;
+    int disarm_deadline(int rval) noexcept;
+    static int progress(void* context) noexcept;
+    static int busy(void* context, int attempts) noexcept;
+    void end_lock_wait(void) noexcept;
+    bool swap_in_memory(sqlite3* source, const backup_options& options) noexcept;
+
     sqlite3* m_db;
     int m_last_error;
+    std::size_t m_cache_capacity;
+    cache_stats m_cache_stats;
+    cache_list m_cache; // most recently used first
+    std::unordered_map<std::string_view, cache_list::iterator> m_cache_index;
+
+    std::chrono::nanoseconds m_timeout;
+    int m_granularity;
+    bool m_progress_installed; // the handler is only registered once a deadline is used
+    bool m_deadline_hit;
+    std::chrono::steady_clock::time_point m_deadline; // of the step running, if any
+    deadline_stats m_deadline_stats;
+
+    // shared with the queries built here, cleared when the db goes away
+    std::shared_ptr<db*> m_self;
+
+    std::optional<busy_policy> m_busy_policy;
+    std::chrono::steady_clock::time_point m_wait_start; // of the lock wait in progress, if any
+    lock_wait_stats m_lock_wait_stats;
+
+    struct profiler
+    {
+      profile_callback callback;
+      std::unordered_map<std::string, statement_profile> statements;
+      std::unordered_map<sqlite3_stmt*, uint64_t> active_rows;
+    };
+
+    static int trace_event(unsigned int event, void* context, void* subject, void* detail) noexcept;
+
+    std::unique_ptr<profiler> m_profiler;
   };
 
   class query
@@ -71,20 +842,68 @@ namespace sql
     bool execute(void) noexcept;
     bool fetchRow(void) noexcept;
 
+    // steps of this query fail with sql::timed_out past the deadline, instead of using
+    // the connection timeout; a default constructed time_point clears it
+    void setDeadline(std::chrono::steady_clock::time_point deadline) noexcept { m_deadline = deadline; }
+    void setTimeout(std::chrono::nanoseconds timeout) noexcept
+      { m_deadline = std::chrono::steady_clock::now() + timeout; }
+
+    // rewinds the statement so it can be executed again, keeping the bound arguments
+    bool reset(void) noexcept;
+    bool clearBindings(void) noexcept;
+
+    // reads one of the SQLITE_STMTSTATUS_* counters of this statement
+    int statementStatus(int counter, bool reset = false) noexcept
+      { return valid() ? sqlite3_stmt_status(m_statement, counter, reset ? 1 : 0) : 0; }
+
+    // binds and executes each row (a value, tuple or pair) with chunked transactions
+    // returns the number of rows committed, lastError() holds the reason for any failure
+    template <typename Range>
+    std::size_t executeBatch(const Range& rows, const batch_options& options = batch_options());
+
+    // range-for over the remaining rows, decoded as a single value, a tuple of the listed
+    // types or a plain struct. e.g. rows<int64_t, std::string_view, std::optional<double>>()
+    template <typename... Ts>
+    row_range<typename row_type<Ts...>::type> rows(void) & noexcept;
+
+    template <typename... Ts>
+    row_range<typename row_type<Ts...>::type, query> rows(void) && noexcept;
+
+    // fetches up to max_rows rows into the column buffers, one buffer per result column
+    // buffers are cleared first but keep their capacity, returns the number of rows fetched
+    template <typename... Ts>
+    std::size_t fetchBatch(std::size_t max_rows, column<Ts>&... columns);
+
     template <typename T>
     query& getField(std::optional<T>& generic);
 
-    template <typename T,  std::enable_if_t<is_sql_type<T>::value, bool> = true>
+    template <typename T,  std::enable_if_t<is_sql_type<T>::value || is_sql_view<T>::value, bool> = true>
     query& getField(T& generic);
 
     template <typename T>
     query& arg(const std::optional<T>& generic, use_t use = copy);
 
-    template <typename T,  std::enable_if_t<is_sql_type<T>::value || is_string_view<T>::value, bool> = true>
-    query& arg(T generic, use_t use = copy);
+    template <typename T,  std::enable_if_t<is_sql_arg<T>::value, bool> = true>
+    query& arg(const T& generic, use_t use = copy);
+
+    // binds every element of a tuple/pair or every member of a plain struct
+    template <typename T,  std::enable_if_t<is_sql_row<T>::value, bool> = true>
+    query& arg(const T& row, use_t use = copy);
 
   private:
-    query(sqlite3_stmt* statement);
+    template <typename Row, typename Source>
+    friend class row_range;
+    friend std::size_t export_stream(query&, const byte_sink&, const stream_options&);
+    friend std::size_t import_stream(db&, const byte_source&, const std::string_view&, const stream_options&);
+
+    query(sqlite3_stmt* statement, std::shared_ptr<db*> owner = nullptr, std::string&& key = std::string());
+
+    db* owner(void) const noexcept { return m_owner ? *m_owner : nullptr; }
+    void release(void) noexcept;
+    int step(void) noexcept;
+
+    bool begin_chunk(bool savepoint) noexcept;
+    bool end_chunk(bool savepoint, bool commit) noexcept;
 
     template <typename T,  std::enable_if_t<std::is_enum_v<T> || std::is_arithmetic_v<T>, bool> = true>
     constexpr int bind(T generic, use_t) { return bind(generic); }
@@ -103,77 +922,383 @@ namespace sql
     int bind(const std::wstring& text, use_t use);
     int bind(const std::u16string_view& text, use_t use);
     int bind(const std::vector<uint8_t>& blob, use_t use);
+    int bind(const std::span<const std::byte>& blob, use_t use);
+    int bind(const zeroblob& blob, use_t use);
+
+    template <typename Row>
+    void decode_row(Row& row);
+
+    template <typename Tuple, std::size_t... I>
+    void decode_columns(Tuple& row, std::index_sequence<I...>);
+
+    template <std::size_t... I, typename... Ts>
+    void append_columns(std::index_sequence<I...>, column<Ts>&... columns);
+
+    template <typename T>
+    void append(column<T>& out, int index);
 
+    template <typename T>
+    void append_fixed(column<T>& out, int index);
+
+    template <typename Element, typename View>
+    void append_arena(arena_column<Element, View>& out, int index);
+
+    template <typename T>
+    void field(std::optional<T>& generic, int index);
+
+    template<typename enum_type, std::enable_if_t<std::is_enum_v<enum_type>, bool> = true>
+    void field(enum_type& enumeration, int index);
+
+    template<typename int_type, std::enable_if_t<std::is_integral_v<int_type>, bool> = true>
+    void field(int_type& number, int index);
+
+    template <typename float_type, std::enable_if_t<std::is_floating_point_v<float_type>, bool> = true>
+    void field(float_type& real, int index);
+
+    void field(std::string& text, int index);
+    void field(std::wstring& text, int index);
+    void field(std::u16string& text, int index);
+    void field(std::vector<uint8_t>& blob, int index);
+    void field(std::string_view& text, int index);
+    void field(std::u16string_view& text, int index);
+    void field(std::span<const std::byte>& blob, int index);
+
+    // rows<>() reads each column's type once, the checks in field() would read it again
+    template <typename T>
+    void decode(T& value, int index);
+
+    // read a column whose type has already been checked
     template<typename enum_type, std::enable_if_t<std::is_enum_v<enum_type>, bool> = true>
-    void field(enum_type& enumeration);
+    void read(enum_type& enumeration, int index) { enumeration = enum_type(sqlite3_column_int(m_statement, index)); }
 
     template<typename int_type, std::enable_if_t<std::is_integral_v<int_type>, bool> = true>
-    void field(int_type& number);
+    void read(int_type& number, int index) { number = int_type(sqlite3_column_int64(m_statement, index)); }
 
     template <typename float_type, std::enable_if_t<std::is_floating_point_v<float_type>, bool> = true>
-    void field(float_type& real);
+    void read(float_type& real, int index) { real = float_type(sqlite3_column_double(m_statement, index)); }
 
-    void field(std::string& text);
-    void field(std::wstring& text);
-    void field(std::u16string& text);
-    void field(std::vector<uint8_t>& blob);
+    void read(std::string& text, int index);
+    void read(std::wstring& text, int index);
+    void read(std::u16string& text, int index);
+    void read(std::vector<uint8_t>& blob, int index);
+    void read(std::string_view& text, int index);
+    void read(std::u16string_view& text, int index);
+    void read(std::span<const std::byte>& blob, int index);
+
+    const void* view_of(const void* data, std::size_t size);
+    void invalidate_views(void) noexcept;
 
     void throw_if_error_binding(int errval);
-    void throw_if_bad_field(int expected_type);
+    void throw_if_bad_field(int expected_type, int index);
+    void throw_if_short_row(int columns);
   private:
     sqlite3_stmt* m_statement;
+    std::shared_ptr<db*> m_owner; // points to null once the db is destroyed
+    std::string m_key;
     int m_last_error;
     int m_arg;
     int m_field;
     bool m_buffered_filled;
+    std::chrono::steady_clock::time_point m_deadline;
+    std::chrono::steady_clock::time_point m_run_deadline; // from the connection timeout
+    std::vector<std::vector<std::byte>> m_view_buffers; // debug builds only
   };
 
-  template <typename T>
-  query& query::arg(const std::optional<T>& generic, use_t use)
+  template <typename Row, typename Source>
+  class row_range
   {
-    if(++m_arg, !valid())
-      throw m_arg;
+  public:
+    class iterator
+    {
+    public:
+      using iterator_category = std::input_iterator_tag;
+      using value_type = Row;
+      using difference_type = std::ptrdiff_t;
+      using pointer = Row*;
+      using reference = Row&;
 
-    throw_if_error_binding(
-          generic.has_value() ? bind(*generic, use)
-                              : sqlite3_bind_null(m_statement, m_arg)
-                          );
-    return *this;
-  }
+      iterator(query* source = nullptr) : m_query(source), m_row() { if(m_query != nullptr) ++*this; }
 
-  template <typename T,  std::enable_if_t<is_sql_type<T>::value || is_string_view<T>::value, bool>>
-  query& query::arg(T generic, use_t use)
-  {
-    if(++m_arg, !valid())
-      throw m_arg;
+      Row& operator*(void) noexcept { return m_row; }
+      Row* operator->(void) noexcept { return &m_row; }
 
-    throw_if_error_binding(bind(generic, use));
-    return *this;
-  }
+      iterator& operator++(void)
+      {
+        if(m_query->fetchRow())
+          m_query->decode_row(m_row);
+        else
+          m_query = nullptr;
+        return *this;
+      }
 
+      bool operator==(const iterator& other) const noexcept { return m_query == other.m_query; }
+      bool operator!=(const iterator& other) const noexcept { return m_query != other.m_query; }
 
-  template <typename T>
-  query& query::getField(std::optional<T>& generic)
-  {
-    if(valid() && sqlite3_column_type(m_statement, m_field) == SQLITE_NULL)
-      generic.reset();
-    else
+    private:
+      query* m_query;
+      Row m_row;
+    };
+
+    row_range(std::conditional_t<std::is_reference_v<Source>, query&, query&&> source) noexcept
+      : m_query(static_cast<Source&&>(source)) { }
+
+    iterator begin(void)
     {
-      T data;
-      field(data);
-      generic.emplace(data);
+      if constexpr (is_tuple_like<Row>::value)
+        m_query.throw_if_short_row(std::tuple_size_v<Row>);
+      else if constexpr (is_sql_aggregate<Row>::value)
+        m_query.throw_if_short_row(detail::aggregate_arity<Row>());
+      else
+        m_query.throw_if_short_row(1);
+      return iterator(&m_query);
     }
-    ++m_field;
-    return *this;
-  }
 
-  template <typename T,  std::enable_if_t<is_sql_type<T>::value, bool>>
-  query& query::getField(T& generic)
-  {
-    field(generic);
-    ++m_field;
-    return *this;
-  }
+    iterator end(void) noexcept { return iterator(); }
+
+  private:
+    Source m_query;
+  };
+
+  template <typename... Ts>
+  row_range<typename row_type<Ts...>::type> query::rows(void) & noexcept
+    { return row_range<typename row_type<Ts...>::type>(*this); }
+
+  template <typename... Ts>
+  row_range<typename row_type<Ts...>::type, query> query::rows(void) && noexcept
+    { return row_range<typename row_type<Ts...>::type, query>(std::move(*this)); }
+
+  template <typename Row>
+  void query::decode_row(Row& row)
+  {
+    if constexpr (is_tuple_like<Row>::value)
+      decode_columns(row, std::make_index_sequence<std::tuple_size_v<Row>>());
+    else if constexpr (is_sql_aggregate<Row>::value)
+    {
+      auto members = detail::tie_members(row);
+      decode_columns(members, std::make_index_sequence<std::tuple_size_v<decltype(members)>>());
+    }
+    else
+      decode(row, 0);
+  }
+
+  template <typename T>
+  void query::decode(T& value, int index)
+  {
+    using type = typename detail::remove_optional<T>::type;
+    constexpr int expected_type = std::is_floating_point_v<type> ? SQLITE_FLOAT :
+                                  std::is_arithmetic_v<type> || std::is_enum_v<type> ? SQLITE_INTEGER :
+                                  std::is_same_v<type, std::vector<uint8_t>> ||
+                                  std::is_same_v<type, std::span<const std::byte>> ? SQLITE_BLOB : SQLITE_TEXT;
+
+    int field_type = sqlite3_column_type(m_statement, index);
+    if constexpr (!std::is_same_v<T, type>)
+    {
+      if(field_type == SQLITE_NULL)
+      {
+        value.reset();
+        return;
+      }
+    }
+    if(field_type != expected_type)
+      throw_if_bad_field(expected_type, index);
+
+    if constexpr (std::is_same_v<T, type>)
+      read(value, index);
+    else
+      read(value.emplace(), index);
+  }
+
+  template <typename Tuple, std::size_t... I>
+  void query::decode_columns(Tuple& row, std::index_sequence<I...>)
+    { (decode(std::get<I>(row), int(I)), ...); }
+
+  template <typename... Ts>
+  std::size_t query::fetchBatch(std::size_t max_rows, column<Ts>&... columns)
+  {
+    (columns.clear(), ...);
+    throw_if_short_row(sizeof...(Ts));
+
+    std::size_t count = 0;
+    for(; count < max_rows && fetchRow(); ++count)
+      append_columns(std::index_sequence_for<Ts...>(), columns...);
+    return count;
+  }
+
+  template <std::size_t... I, typename... Ts>
+  void query::append_columns(std::index_sequence<I...>, column<Ts>&... columns)
+    { (append(columns, int(I)), ...); }
+
+  template <typename T>
+  void query::append(column<T>& out, int index)
+  {
+    if constexpr (std::is_arithmetic_v<T> || std::is_enum_v<T>)
+      append_fixed(out, index);
+    else
+      append_arena(out, index);
+  }
+
+  template <typename T>
+  void query::append_fixed(column<T>& out, int index)
+  {
+    constexpr int expected_type = std::is_floating_point_v<T> ? SQLITE_FLOAT : SQLITE_INTEGER;
+    int field_type = sqlite3_column_type(m_statement, index);
+    if(field_type == SQLITE_NULL)
+    {
+      out.push_validity(false);
+      out.m_values.push_back(T());
+      return;
+    }
+
+    if(field_type != expected_type)
+      throw_if_bad_field(expected_type, index);
+
+    out.push_validity(true);
+    if constexpr (std::is_floating_point_v<T>)
+      out.m_values.push_back(T(sqlite3_column_double(m_statement, index)));
+    else
+      out.m_values.push_back(T(sqlite3_column_int64(m_statement, index)));
+  }
+
+  template <typename Element, typename View>
+  void query::append_arena(arena_column<Element, View>& out, int index)
+  {
+    constexpr int expected_type = std::is_same_v<Element, char> ? SQLITE_TEXT : SQLITE_BLOB;
+    int field_type = sqlite3_column_type(m_statement, index);
+    if(field_type != SQLITE_NULL)
+    {
+      if(field_type != expected_type)
+        throw_if_bad_field(expected_type, index);
+
+      const Element* data = static_cast<const Element*>(expected_type == SQLITE_TEXT
+                                                        ? static_cast<const void*>(sqlite3_column_text(m_statement, index))
+                                                        : sqlite3_column_blob(m_statement, index));
+      out.m_data.insert(out.m_data.end(), data, data + sqlite3_column_bytes(m_statement, index));
+    }
+    out.push_validity(field_type != SQLITE_NULL);
+    out.m_offsets.push_back(out.m_data.size());
+  }
+
+  template <typename T>
+  query& query::arg(const std::optional<T>& generic, use_t use)
+  {
+    if(++m_arg, !valid())
+      throw m_arg;
+
+    throw_if_error_binding(
+          generic.has_value() ? bind(*generic, use)
+                              : sqlite3_bind_null(m_statement, m_arg)
+                          );
+    return *this;
+  }
+
+  template <typename T,  std::enable_if_t<is_sql_arg<T>::value, bool>>
+  query& query::arg(const T& generic, use_t use)
+  {
+    if(++m_arg, !valid())
+      throw m_arg;
+
+    throw_if_error_binding(bind(generic, use));
+    return *this;
+  }
+
+  template <typename T,  std::enable_if_t<is_sql_row<T>::value, bool>>
+  query& query::arg(const T& row, use_t use)
+  {
+    auto bind_all = [this, use](const auto&... values) { (arg(values, use), ...); };
+    if constexpr (is_tuple_like<T>::value)
+      std::apply(bind_all, row);
+    else
+      std::apply(bind_all, detail::tie_members(row));
+    return *this;
+  }
+
+
+  template <typename Range>
+  std::size_t query::executeBatch(const Range& rows, const batch_options& options)
+  {
+    std::size_t committed = 0;
+    std::size_t pending = 0;
+    std::size_t chunk_rows = 0;
+    bool in_chunk = false;
+    bool chunk_ok = true;
+    int failure = SQLITE_OK;
+
+    if(!valid())
+      return 0;
+
+    // inside the caller's transaction chunks can only nest as savepoints, which commit with it
+    const bool savepoint = options.savepoint_per_chunk || !sqlite3_get_autocommit(sqlite3_db_handle(m_statement));
+
+    for(const auto& row : rows)
+    {
+      if(!in_chunk)
+      {
+        if(!begin_chunk(savepoint))
+          return committed;
+        in_chunk = true;
+        chunk_ok = true;
+        pending = 0;
+        chunk_rows = 0;
+      }
+
+      if(chunk_ok) // rows after a failure are skipped until the chunk ends
+      {
+        reset();
+        try { arg(row); }
+        catch(...)
+        {
+          end_chunk(savepoint, false);
+          throw;
+        }
+
+        if(execute())
+          ++pending;
+        else
+        {
+          chunk_ok = false;
+          failure = m_last_error;
+          if(!options.savepoint_per_chunk)
+          {
+            end_chunk(savepoint, false);
+            return committed;
+          }
+        }
+      }
+
+      if(++chunk_rows == options.chunk_size)
+      {
+        in_chunk = false;
+        if(end_chunk(savepoint, chunk_ok) && chunk_ok)
+          committed += pending;
+        else if(!options.savepoint_per_chunk)
+          return committed;
+        else if(chunk_ok) // the commit itself failed
+          failure = m_last_error;
+      }
+    }
+
+    if(in_chunk && end_chunk(savepoint, chunk_ok) && chunk_ok)
+      committed += pending;
+    if(failure != SQLITE_OK)
+      m_last_error = failure;
+    return committed;
+  }
+
+  template <typename T>
+  query& query::getField(std::optional<T>& generic)
+  {
+    field(generic, m_field);
+    ++m_field;
+    return *this;
+  }
+
+  template <typename T,  std::enable_if_t<is_sql_type<T>::value || is_sql_view<T>::value, bool>>
+  query& query::getField(T& generic)
+  {
+    field(generic, m_field);
+    ++m_field;
+    return *this;
+  }
 
   template<typename enum_type, std::enable_if_t<std::is_enum_v<enum_type>, bool>>
   int query::bind(enum_type enumeration)
@@ -188,25 +1313,1195 @@ namespace sql
     { return sqlite3_bind_double(m_statement, m_arg, real); }
 
 
+  template <typename T>
+  void query::field(std::optional<T>& generic, int index)
+  {
+    if(valid() && sqlite3_column_type(m_statement, index) == SQLITE_NULL)
+      generic.reset();
+    else
+      field(generic.emplace(), index);
+  }
+
   template<typename enum_type, std::enable_if_t<std::is_enum_v<enum_type>, bool>>
-  void query::field(enum_type& enumeration)
+  void query::field(enum_type& enumeration, int index)
   {
-    throw_if_bad_field(SQLITE_INTEGER);
-    enumeration = enum_type(sqlite3_column_int(m_statement, m_field));
+    throw_if_bad_field(SQLITE_INTEGER, index);
+    read(enumeration, index);
   }
 
   template<typename int_type, std::enable_if_t<std::is_integral_v<int_type>, bool>>
-  void query::field(int_type& number)
+  void query::field(int_type& number, int index)
   {
-    throw_if_bad_field(SQLITE_INTEGER);
-    number = sqlite3_column_int64(m_statement, m_field);
+    throw_if_bad_field(SQLITE_INTEGER, index);
+    read(number, index);
   }
 
   template <typename float_type, std::enable_if_t<std::is_floating_point_v<float_type>, bool>>
-  void query::field(float_type& real)
+  void query::field(float_type& real, int index)
+  {
+    throw_if_bad_field(SQLITE_FLOAT, index);
+    read(real, index);
+  }
+
+  template <typename F>
+  bool db::register_function(const std::string_view& name, F&& f, int flags) noexcept
+  {
+    using function_type = std::decay_t<F>;
+    using arguments = typename detail::signature_of<function_type>::arguments;
+    using result = typename detail::signature_of<function_type>::result;
+    static_assert([]<std::size_t... I>(std::index_sequence<I...>)
+                    { return (detail::is_function_value<std::tuple_element_t<I, arguments>>::value && ...); }
+                    (std::make_index_sequence<std::tuple_size_v<arguments>>()),
+                  "function arguments must be SQL types, views or optionals of them");
+    static_assert(std::is_void_v<result> || detail::is_function_value<std::decay_t<result>>::value,
+                  "function result must be void, an SQL type, a view or an optional of them");
+
+    function_type* function = new(std::nothrow) function_type(std::forward<F>(f));
+    if(function == nullptr)
+    {
+      m_last_error = SQLITE_NOMEM;
+      return false;
+    }
+
+    auto call = [](sqlite3_context* context, int, sqlite3_value** values) noexcept
+    {
+      detail::guarded_call(context, [&]
+      {
+        function_type& target = *static_cast<function_type*>(sqlite3_user_data(context));
+        auto args = detail::from_values<arguments>(values, std::make_index_sequence<std::tuple_size_v<arguments>>());
+        if constexpr (std::is_void_v<result>)
+          std::apply(target, std::move(args));
+        else
+          detail::set_result(context, std::apply(target, std::move(args)));
+      });
+    };
+
+    // SQLite calls the destructor itself, even when registration fails
+    m_last_error = sqlite3_create_function_v2(m_db, std::string(name).c_str(),
+                                              std::tuple_size_v<arguments>,
+                                              SQLITE_UTF8 | flags,
+                                              function, call, nullptr, nullptr,
+                                              [](void* data) noexcept { delete static_cast<function_type*>(data); });
+    return m_last_error == SQLITE_OK;
+  }
+
+  template <typename State>
+  bool db::register_aggregate(const std::string_view& name, int flags) noexcept
+  {
+    static_assert(std::is_default_constructible_v<State>, "aggregate state must be default constructible");
+    using callbacks = detail::aggregate<State>;
+    constexpr int arity = std::tuple_size_v<typename callbacks::arguments>;
+    static_assert(detail::is_function_value<typename callbacks::result>::value,
+                  "aggregate value must be an SQL type, a view or an optional of them");
+
+    if constexpr (requires { &State::inverse; })
+      m_last_error = sqlite3_create_window_function(m_db, std::string(name).c_str(), arity, SQLITE_UTF8 | flags, nullptr,
+                                                    callbacks::step, callbacks::final,
+                                                    callbacks::value, callbacks::inverse, nullptr);
+    else
+      m_last_error = sqlite3_create_function_v2(m_db, std::string(name).c_str(), arity, SQLITE_UTF8 | flags, nullptr,
+                                                nullptr, callbacks::step, callbacks::final, nullptr);
+    return m_last_error == SQLITE_OK;
+  }
+
+  // one writer and a fixed set of read-only connections to the same WAL mode database
+  // readers are handed out without locking; a thread keeps getting the same reader while
+  // it is free so each reader's statement cache stays warm for that thread
+  class pool
+  {
+  public:
+    class connection
+    {
+      friend class pool;
+    public:
+      connection(connection&& other) noexcept;
+      ~connection(void) noexcept;
+
+      connection(const connection&) = delete;
+      connection& operator=(const connection&) = delete;
+      connection& operator=(connection&&) = delete;
+
+      db& operator*(void) const noexcept { return *m_db; }
+      db* operator->(void) const noexcept { return m_db; }
+
+    private:
+      connection(pool* owner, db* handle, std::size_t slot) noexcept;
+
+      pool* m_pool;
+      db* m_db;
+      std::size_t m_slot;
+    };
+
+    pool(void) noexcept;
+    ~pool(void) noexcept;
+
+    pool(const pool&) = delete;
+    pool& operator=(const pool&) = delete;
+
+    constexpr int lastError(void) const noexcept { return m_last_error; }
+
+    // in-memory databases can't be shared between connections
+    bool open(const std::string_view& filename, std::size_t readers) noexcept;
+    bool close(void) noexcept;
+
+    constexpr std::size_t readerCount(void) const noexcept { return m_reader_count; }
+
+    connection reader(void) noexcept; // waits if every reader is checked out
+    connection writer(void) noexcept; // serialized between threads
+
+  private:
+    static constexpr std::size_t writer_slot = std::size_t(-1);
+
+    struct alignas(64) reader_slot
+    {
+      std::atomic<bool> busy { false };
+      db handle;
+    };
+
+    void release(std::size_t slot) noexcept;
+
+    int m_last_error;
+    db m_writer;
+    std::mutex m_writer_lock;
+    std::unique_ptr<reader_slot[]> m_readers;
+    std::size_t m_reader_count;
+    std::atomic<uint32_t> m_released; // bumped on every reader release, used as a wait/notify futex
+  };
+
+  struct group_commit_options
+  {
+    std::size_t max_batch = 1024; // writes per transaction
+    std::chrono::microseconds max_delay { 0 }; // time to linger for more writes before committing
+  };
+
+  // views are stored as owning strings so queued arguments can't dangle
+  template< class T >
+  struct owned_arg { using type = T; };
+
+  template<>
+  struct owned_arg<std::string_view> { using type = std::string; };
+
+  template<>
+  struct owned_arg<const char*> { using type = std::string; };
+
+  template<>
+  struct owned_arg<char*> { using type = std::string; };
+
+  template<>
+  struct owned_arg<std::u16string_view> { using type = std::u16string; };
+
+  // fire-and-forget writes drained by a dedicated thread and committed in groups
+  // the db must not be used by anything else between start() and stop()
+  // completions receive SQLITE_OK once the transaction holding the write has committed
+  class async_writer
+  {
+  public:
+    using completion = std::function<void(int)>;
+
+    async_writer(void) noexcept;
+    ~async_writer(void) noexcept;
+
+    async_writer(const async_writer&) = delete;
+    async_writer& operator=(const async_writer&) = delete;
+
+    bool start(db& target, const group_commit_options& options = group_commit_options());
+    void stop(void) noexcept; // commits everything already queued
+
+    template <typename... Args>
+    void post(completion done, std::string sql, Args&&... args);
+
+    template <typename... Args>
+    std::future<int> enqueue(std::string sql, Args&&... args);
+
+  private:
+    struct operation
+    {
+      std::string sql;
+      std::function<void(query&)> bind;
+      completion done;
+      operation* next;
+    };
+
+    void push(operation* op) noexcept;
+    void run(void) noexcept;
+    void commit(std::vector<operation*>& batch) noexcept;
+
+    db* m_db;
+    group_commit_options m_options;
+    std::thread m_thread;
+    std::atomic<operation*> m_head; // lock-free LIFO, reversed by the consumer
+    std::atomic<uint32_t> m_signal; // bumped when the queue becomes non-empty
+    std::atomic<bool> m_running;
+    std::atomic<uint32_t> m_pushing; // pushes between their m_running check and the link
+  };
+
+  template <typename... Args>
+  void async_writer::post(completion done, std::string sql, Args&&... args)
+  {
+    static_assert((!std::is_same_v<std::decay_t<Args>, std::span<const std::byte>> && ...),
+                  "blob spans can't be queued, pass a std::vector<uint8_t>");
+
+    std::tuple<typename owned_arg<std::decay_t<Args>>::type...> values(std::forward<Args>(args)...);
+    push(new operation
+         {
+           std::move(sql),
+           [values = std::move(values)](query& q) { if constexpr (sizeof...(Args) > 0) q.arg(values); },
+           std::move(done),
+           nullptr
+         });
+  }
+
+  template <typename... Args>
+  std::future<int> async_writer::enqueue(std::string sql, Args&&... args)
+  {
+    auto promise = std::make_shared<std::promise<int>>();
+    std::future<int> result = promise->get_future();
+    post([promise](int rval) { promise->set_value(rval); }, std::move(sql), std::forward<Args>(args)...);
+    return result;
+  }
+
+  struct checkpoint_options
+  {
+    int passive_frames = 1000; // WAL backlog that triggers a PASSIVE checkpoint
+    int restart_frames = 10000; // WAL size that triggers a RESTART, which waits for readers
+    std::chrono::milliseconds idle_time { 200 }; // any backlog is checkpointed after this long without commits
+    std::chrono::milliseconds poll_interval { 100 };
+    std::chrono::milliseconds restart_wait { 1000 }; // busy timeout for a RESTART
+  };
+
+  struct checkpoint_stats
+  {
+    uint64_t passive;
+    uint64_t restarts;
+    uint64_t busy; // checkpoints that couldn't finish because of readers or writers
+    uint64_t errors;
+    int64_t wal_frames; // frames in the WAL after the last commit or checkpoint
+    int64_t wal_bytes;
+    int64_t frames_checkpointed;
+    uint64_t last_ns;
+    uint64_t max_ns;
+    uint64_t total_ns;
+  };
+
+  // checkpoints a WAL mode database from its own thread and connection so writers never
+  // pay for an auto-checkpoint; start() and stop() belong to the thread using the db
+  class checkpointer
+  {
+  public:
+    checkpointer(void) noexcept;
+    ~checkpointer(void) noexcept;
+
+    checkpointer(const checkpointer&) = delete;
+    checkpointer& operator=(const checkpointer&) = delete;
+
+    constexpr int lastError(void) const noexcept { return m_last_error; } // of start()
+
+    // replaces the connection's auto-checkpoint until stop(), which restores its previous setting
+    bool start(db& target, const checkpoint_options& options = checkpoint_options());
+    void stop(void) noexcept;
+
+    checkpoint_stats stats(void) const noexcept;
+
+  private:
+    static int wal_committed(void* context, sqlite3* handle, const char* schema, int frames) noexcept;
+    void run(void) noexcept;
+
+    db* m_target;
+    db m_connection;
+    checkpoint_options m_options;
+    int64_t m_page_size;
+    int m_autocheckpoint; // of the target before start()
+    int m_last_error;
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+    std::atomic<int> m_wal_frames; // published by the writer's commit hook
+    std::atomic<int64_t> m_last_commit; // steady clock ticks
+    mutable std::mutex m_lock;
+    std::condition_variable m_wakeup;
+    checkpoint_stats m_stats;
+  };
+
+  // spreads keys over several database files, one connection per shard
+  // single key work is routed to its shard, fan-out work runs on every shard in parallel
+  // on an internal thread pool; like db, a sharded_db is used from one thread at a time
+  class sharded_db
+  {
+  public:
+    // maps the bytes of a key to a 64 bit hash, integer keys are hashed as int64_t
+    using hash_function = std::function<uint64_t(std::span<const std::byte> key)>;
+
+    sharded_db(void) noexcept;
+    ~sharded_db(void) noexcept;
+
+    sharded_db(const sharded_db&) = delete;
+    sharded_db& operator=(const sharded_db&) = delete;
+
+    constexpr int lastError(void) const noexcept { return m_last_error; }
+
+    // threads defaults to one per shard, capped at the hardware concurrency
+    bool open(const std::vector<std::string>& filenames, hash_function hash = nullptr, std::size_t threads = 0);
+    bool close(void) noexcept;
+
+    std::size_t size(void) const noexcept { return m_shards.size(); }
+    db& shard(std::size_t index) noexcept { return *m_shards[index]; }
+
+    // jump consistent hashing, adding a shard only moves 1/N of the keys
+    // returns size() when no shards are open
+    template <typename Key>
+    std::size_t shardOf(const Key& key) const noexcept;
+
+    // throws when no shards are open
+    template <typename Key>
+    db& shardFor(const Key& key);
+
+    template <typename Key>
+    query build_query(const Key& key, const std::string_view& query_str) { return shardFor(key).build_query(query_str); }
+
+    // runs on every shard in parallel, lastError() holds the first failure
+    bool execute(const std::string_view& sql_str);
+
+    // calls f(db&, shard index) on every shard concurrently and waits for all of them
+    // the first exception thrown is rethrown here; must not be called from f
+    template <typename F>
+    void parallel(F&& f);
+
+    // runs the query with the same arguments on every shard, rows are concatenated in shard order
+    template <typename... Ts, typename... Args>
+    std::vector<typename row_type<Ts...>::type> gather(const std::string_view& query_str, const Args&... args);
+
+    // for queries whose results are ordered by comp on every shard, e.g. ORDER BY ... LIMIT n
+    // the shard results are k-way merged and cut at limit (zero for all rows)
+    template <typename... Ts, typename Compare = std::less<>, typename... Args>
+    std::vector<typename row_type<Ts...>::type> gatherSorted(const std::string_view& query_str,
+                                                             std::size_t limit,
+                                                             Compare comp,
+                                                             const Args&... args);
+
+  private:
+    template <typename Key>
+    static uint64_t hash_key(const hash_function& hash, const Key& key) noexcept;
+
+    template <typename Row, typename... Ts, typename... Args>
+    std::vector<std::vector<Row>> scatter(const std::string_view& query_str, const Args&... args);
+
+    void submit(std::function<void(void)> task);
+    void work(void) noexcept;
+
+    std::vector<std::unique_ptr<db>> m_shards;
+    hash_function m_hash;
+    int m_last_error;
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_lock;
+    std::condition_variable m_wakeup;
+    std::vector<std::function<void(void)>> m_tasks;
+    bool m_running;
+  };
+
+  template <typename Key>
+  uint64_t sharded_db::hash_key(const hash_function& hash, const Key& key) noexcept
+  {
+    if constexpr (std::is_integral_v<Key> || std::is_enum_v<Key>)
+    {
+      int64_t value = int64_t(key);
+      return hash(std::as_bytes(std::span<const int64_t>(&value, 1)));
+    }
+    else if constexpr (std::is_convertible_v<const Key&, std::string_view>)
+    {
+      std::string_view text = key;
+      return hash(std::as_bytes(std::span<const char>(text.data(), text.size())));
+    }
+    else // blobs
+      return hash(std::as_bytes(std::span(key)));
+  }
+
+  template <typename Key>
+  std::size_t sharded_db::shardOf(const Key& key) const noexcept
+  {
+    if(m_shards.empty())
+      return m_shards.size();
+
+    uint64_t state = hash_key(m_hash, key);
+    int64_t bucket = -1, next = 0;
+    while(next < int64_t(m_shards.size()))
+    {
+      bucket = next;
+      state = state * 2862933555777941757ULL + 1;
+      next = int64_t(double(bucket + 1) * (double(1LL << 31) / double((state >> 33) + 1)));
+    }
+    return std::size_t(bucket);
+  }
+
+  template <typename Key>
+  db& sharded_db::shardFor(const Key& key)
+  {
+    std::size_t index = shardOf(key);
+    if(index >= m_shards.size())
+    {
+      m_last_error = SQLITE_MISUSE;
+      throw std::string("shard for: no shards open");
+    }
+    return shard(index);
+  }
+
+  template <typename F>
+  void sharded_db::parallel(F&& f)
+  {
+    std::latch done(std::ptrdiff_t(m_shards.size()));
+    std::vector<std::exception_ptr> errors(m_shards.size());
+    std::size_t index = 0;
+    try
+    {
+      for(; index < m_shards.size(); ++index)
+      {
+        submit([&, index](void)
+        {
+          try { f(*m_shards[index], index); }
+          catch(...) { errors[index] = std::current_exception(); }
+          done.count_down();
+        });
+      }
+    }
+    catch(...)
+    {
+      // tasks already queued reference done and errors, let them finish first
+      done.count_down(std::ptrdiff_t(m_shards.size() - index));
+      done.wait();
+      throw;
+    }
+    done.wait();
+
+    for(std::exception_ptr& error : errors)
+      if(error)
+        std::rethrow_exception(error);
+  }
+
+  template <typename Row, typename... Ts, typename... Args>
+  std::vector<std::vector<Row>> sharded_db::scatter(const std::string_view& query_str, const Args&... args)
+  {
+    static_assert((!is_sql_view<Ts>::value && ...), "views don't outlive the shard's query, fetch owning types");
+
+    std::vector<std::vector<Row>> results(m_shards.size());
+    parallel([&](db& shard, std::size_t index)
+    {
+      query q = shard.build_query(query_str);
+      (q.arg(args), ...);
+      for(Row& row : q.template rows<Ts...>())
+        results[index].push_back(std::move(row));
+      if(q.lastError() != SQLITE_DONE)
+        throw "gather: " + std::string(sqlite3_errstr(q.lastError())).append("\ninput: ").append(query_str);
+    });
+    return results;
+  }
+
+  template <typename... Ts, typename... Args>
+  std::vector<typename row_type<Ts...>::type> sharded_db::gather(const std::string_view& query_str, const Args&... args)
+  {
+    using row = typename row_type<Ts...>::type;
+    std::vector<std::vector<row>> results = scatter<row, Ts...>(query_str, args...);
+
+    std::size_t total = 0;
+    for(const std::vector<row>& part : results)
+      total += part.size();
+
+    std::vector<row> rows;
+    rows.reserve(total);
+    for(std::vector<row>& part : results)
+      std::move(part.begin(), part.end(), std::back_inserter(rows));
+    return rows;
+  }
+
+  template <typename... Ts, typename Compare, typename... Args>
+  std::vector<typename row_type<Ts...>::type> sharded_db::gatherSorted(const std::string_view& query_str,
+                                                                       std::size_t limit,
+                                                                       Compare comp,
+                                                                       const Args&... args)
+  {
+    using row = typename row_type<Ts...>::type;
+    std::vector<std::vector<row>> results = scatter<row, Ts...>(query_str, args...);
+
+    // min-heap of the next unmerged row of every shard
+    using cursor = std::pair<std::size_t, std::size_t>; // shard, position
+    auto later = [&](const cursor& a, const cursor& b)
+      { return comp(results[b.first][b.second], results[a.first][a.second]); };
+    std::priority_queue<cursor, std::vector<cursor>, decltype(later)> heads(later);
+    std::size_t total = 0;
+    for(std::size_t index = 0; index < results.size(); ++index)
+    {
+      total += results[index].size();
+      if(!results[index].empty())
+        heads.emplace(index, 0);
+    }
+
+    std::vector<row> rows;
+    rows.reserve(limit != 0 ? std::min(limit, total) : total);
+    while(!heads.empty() && (limit == 0 || rows.size() < limit))
+    {
+      cursor next = heads.top();
+      heads.pop();
+      rows.push_back(std::move(results[next.first][next.second]));
+      if(++next.second < results[next.first].size())
+        heads.push(next);
+    }
+    return rows;
+  }
+
+  // incremental access to a single blob value without loading it into memory
+  // the blob can't change size, reserve space on insert by binding a zeroblob
+  class blob_stream
+  {
+  public:
+    blob_stream(void) noexcept;
+    ~blob_stream(void) noexcept;
+
+    blob_stream(const blob_stream&) = delete;
+    blob_stream& operator=(const blob_stream&) = delete;
+
+    constexpr int lastError(void) const noexcept { return m_last_error; }
+    constexpr bool valid(void) const noexcept { return m_blob != nullptr; }
+
+    bool open(db& database,
+              const std::string& table,
+              const std::string& column,
+              int64_t rowid,
+              bool writable = false,
+              const std::string& schema = "main") noexcept;
+    bool reopen(int64_t rowid) noexcept; // same table and column, much cheaper than open()
+    bool close(void) noexcept;
+
+    int size(void) const noexcept;
+    constexpr int tell(void) const noexcept { return m_position; }
+    bool seek(int position) noexcept;
+
+    // sequential access from tell(), returns the number of bytes transferred
+    int read(std::span<std::byte> buffer) noexcept;
+    int write(std::span<const std::byte> buffer) noexcept;
+
+    // random access, does not move tell()
+    bool readAt(std::span<std::byte> buffer, int offset) noexcept;
+    bool writeAt(std::span<const std::byte> buffer, int offset) noexcept;
+
+  private:
+    sqlite3_blob* m_blob;
+    int m_position;
+    int m_last_error;
+  };
+
+  // std::streambuf over a blob_stream with a fixed size chunk buffer
+  // use with std::istream / std::ostream to stream a blob in bounded memory
+  class blob_streambuf : public std::streambuf
+  {
+  public:
+    blob_streambuf(blob_stream& blob, std::size_t chunk_size = 64 * 1024);
+    ~blob_streambuf(void) override;
+
+  protected:
+    int_type underflow(void) override;
+    int_type overflow(int_type ch) override;
+    int sync(void) override;
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type position, std::ios_base::openmode which) override;
+
+  private:
+    bool flush_chunk(void) noexcept;
+
+    blob_stream& m_blob;
+    std::vector<char> m_chunk;
+  };
+
+#ifdef SQLITE_ENABLE_SESSION
+  // a change that couldn't be applied cleanly, see sqlite3changeset_apply()
+  class changeset_conflict
+  {
+  public:
+    changeset_conflict(int type, sqlite3_changeset_iter* iterator) noexcept;
+
+    constexpr int type(void) const noexcept { return m_type; } // SQLITE_CHANGESET_DATA, _NOTFOUND, _CONFLICT, ...
+    constexpr int operation(void) const noexcept { return m_operation; } // SQLITE_INSERT, _UPDATE or _DELETE
+    constexpr std::string_view table(void) const noexcept { return m_table; }
+    constexpr int columns(void) const noexcept { return m_columns; }
+
+    // the row as it was before and after the change, and the row already in the database
+    // values are only valid during the callback, unchanged columns of an update are null
+    template <typename T>
+    std::optional<T> before(int column) const noexcept { return value<T>(sqlite3changeset_old, column); }
+    template <typename T>
+    std::optional<T> after(int column) const noexcept { return value<T>(sqlite3changeset_new, column); }
+    template <typename T>
+    std::optional<T> existing(int column) const noexcept { return value<T>(sqlite3changeset_conflict, column); }
+
+    constexpr sqlite3_changeset_iter* getHandle(void) const noexcept { return m_iterator; }
+
+  private:
+    template <typename T>
+    std::optional<T> value(int (*accessor)(sqlite3_changeset_iter*, int, sqlite3_value**), int column) const noexcept
+    {
+      sqlite3_value* result = nullptr;
+      if(accessor(m_iterator, column, &result) != SQLITE_OK || result == nullptr)
+        return std::nullopt;
+      return detail::from_value<std::optional<T>>(result);
+    }
+
+    int m_type;
+    int m_operation;
+    int m_columns;
+    std::string_view m_table;
+    sqlite3_changeset_iter* m_iterator;
+  };
+
+  // records changes made through one connection to the attached tables, only tables with
+  // a primary key are tracked; close it before the connection
+  class session
+  {
+  public:
+    session(void) noexcept;
+    ~session(void) noexcept;
+
+    session(const session&) = delete;
+    session& operator=(const session&) = delete;
+
+    constexpr int lastError(void) const noexcept { return m_last_error; }
+    constexpr bool valid(void) const noexcept { return m_session != nullptr; }
+
+    bool open(db& database, const std::string& schema = "main") noexcept;
+    bool close(void) noexcept;
+
+    // an empty name attaches every table, including ones created later
+    bool attach(const std::string& table = std::string()) noexcept;
+    bool enable(bool enabled) noexcept;
+    bool empty(void) const noexcept { return valid() && sqlite3session_isempty(m_session); }
+
+    // changesets carry full before images and can detect every conflict, patchsets
+    // are smaller but only carry primary keys and new values
+    // everything recorded since open() or the last take
+    bool changeset(std::vector<uint8_t>& out) noexcept;
+    bool patchset(std::vector<uint8_t>& out) noexcept;
+
+    // ends the current capture window and starts a new one on the same tables
+    bool takeChangeset(std::vector<uint8_t>& out) noexcept;
+    bool takePatchset(std::vector<uint8_t>& out) noexcept;
+
+  private:
+    bool collect(int (*generate)(sqlite3_session*, int*, void**), std::vector<uint8_t>& out) noexcept;
+    bool restart(void) noexcept;
+
+    sqlite3_session* m_session;
+    sqlite3* m_db;
+    std::string m_schema;
+    std::vector<std::string> m_tables;
+    int m_last_error;
+  };
+#endif
+
+  // exposes a random access container of rows to SQL as an eponymous virtual table, read in place
+  // rows are plain structs or tuples of SQL types, views or optionals of them
+  // equality and range constraints on key columns are answered from a sorted index of row
+  // positions built on first use, call invalidate() after the container changes
+  // unique columns are keys that never repeat a value, SQLite may then expect one row per lookup
+  // the table and the container must outlive every connection it's attached to
+  template <typename T, typename Container = std::vector<T>>
+  class virtual_table
+  {
+  public:
+    virtual_table(const Container& rows, std::vector<std::string> columns, std::vector<int> key_columns = {}, std::vector<int> unique_columns = {});
+
+    virtual_table(const virtual_table&) = delete;
+    virtual_table& operator=(const virtual_table&) = delete;
+
+    constexpr int lastError(void) const noexcept { return m_last_error; }
+
+    // the table is queried by name, no CREATE VIRTUAL TABLE is needed
+    bool attach(db& database, const std::string_view& name) noexcept;
+    bool detach(db& database, const std::string_view& name) noexcept;
+    void invalidate(void) noexcept;
+
+  private:
+    static_assert(is_sql_row<T>::value, "virtual table rows must be plain structs or tuples");
+
+    static auto members(const T& row) noexcept
+    {
+      if constexpr (is_tuple_like<T>::value)
+        return std::apply([](const auto&... member) { return std::tie(member...); }, row);
+      else
+        return detail::tie_members(row);
+    }
+
+    using member_tuple = decltype(members(std::declval<const T&>()));
+    static constexpr std::size_t arity = std::tuple_size_v<member_tuple>;
+
+    template <std::size_t I>
+    using member_type = std::remove_cvref_t<std::tuple_element_t<I, member_tuple>>;
+
+    template <std::size_t I>
+    using key_type = typename detail::remove_optional<member_type<I>>::type;
+
+    // only columns with an ordering SQLite agrees with can be pushed down
+    template <std::size_t I>
+    static constexpr bool indexable = std::is_arithmetic_v<key_type<I>> ||
+                                      std::is_enum_v<key_type<I>> ||
+                                      std::is_same_v<key_type<I>, std::string> ||
+                                      std::is_same_v<key_type<I>, std::string_view>;
+
+    template <typename F>
+    static void visit_column(int column, F&& f)
+    {
+      [&]<std::size_t... I>(std::index_sequence<I...>)
+        { (void)((I == std::size_t(column) ? (f(std::integral_constant<std::size_t, I>()), true) : false) || ...); }
+        (std::make_index_sequence<arity>());
+    }
+
+    struct table
+    {
+      sqlite3_vtab base;
+      virtual_table* owner;
+    };
+
+    struct cursor
+    {
+      sqlite3_vtab_cursor base;
+      const std::vector<std::size_t>* order; // null for a scan in container order
+      std::size_t current;
+      std::size_t end;
+    };
+
+    enum bound_flag : int
+    {
+      equal = 1 << 8,
+      lower = 1 << 9,
+      upper = 1 << 10,
+    };
+
+    std::size_t size(void) const noexcept { return std::size(*m_rows); }
+    const T& row(std::size_t position) const noexcept { return std::begin(*m_rows)[position]; }
+    const std::vector<std::size_t>& index(int column);
+
+    template <std::size_t I>
+    void narrow(cursor& position, int flags, sqlite3_value** values) const;
+    double estimate(int key, const std::array<int, 3>& args, sqlite3_index_info* info);
+
+    static const sqlite3_module* module(void) noexcept;
+    static int connect(sqlite3* handle, void* aux, int, const char* const*, sqlite3_vtab** vtab, char** error) noexcept;
+    static int disconnect(sqlite3_vtab* vtab) noexcept;
+    static int best_index(sqlite3_vtab* vtab, sqlite3_index_info* info) noexcept;
+    static int open(sqlite3_vtab* vtab, sqlite3_vtab_cursor** result) noexcept;
+    static int close(sqlite3_vtab_cursor* base) noexcept;
+    static int filter(sqlite3_vtab_cursor* base, int plan, const char*, int, sqlite3_value** values) noexcept;
+    static int next(sqlite3_vtab_cursor* base) noexcept;
+    static int eof(sqlite3_vtab_cursor* base) noexcept;
+    static int column(sqlite3_vtab_cursor* base, sqlite3_context* context, int index) noexcept;
+    static int rowid(sqlite3_vtab_cursor* base, sqlite3_int64* result) noexcept;
+
+    const Container* m_rows;
+    std::vector<std::string> m_columns;
+    std::vector<int> m_keys;
+    std::vector<int> m_unique;
+    std::mutex m_index_lock;
+    std::vector<std::unique_ptr<std::vector<std::size_t>>> m_indexes; // row positions sorted per key column
+    int m_last_error;
+  };
+
+  template <typename T, typename Container>
+  virtual_table<T, Container>::virtual_table(const Container& rows, std::vector<std::string> columns, std::vector<int> key_columns, std::vector<int> unique_columns)
+    : m_rows(&rows),
+      m_columns(std::move(columns)),
+      m_indexes(arity),
+      m_last_error(SQLITE_OK)
+  {
+    for(int key : key_columns)
+      visit_column(key, [&](auto I) { if constexpr (indexable<I>) m_keys.push_back(key); });
+    for(int key : unique_columns)
+    {
+      visit_column(key, [&](auto I)
+      {
+        if constexpr (indexable<I>)
+        {
+          if(std::find(m_keys.begin(), m_keys.end(), key) == m_keys.end())
+            m_keys.push_back(key);
+          m_unique.push_back(key);
+        }
+      });
+    }
+  }
+
+  template <typename T, typename Container>
+  bool virtual_table<T, Container>::attach(db& database, const std::string_view& name) noexcept
+  {
+    if(m_columns.size() != arity)
+      m_last_error = SQLITE_MISUSE;
+    else
+      m_last_error = sqlite3_create_module_v2(database.getHandle(), std::string(name).c_str(), module(), this, nullptr);
+    return m_last_error == SQLITE_OK;
+  }
+
+  template <typename T, typename Container>
+  bool virtual_table<T, Container>::detach(db& database, const std::string_view& name) noexcept
+  {
+    m_last_error = sqlite3_create_module_v2(database.getHandle(), std::string(name).c_str(), nullptr, nullptr, nullptr);
+    return m_last_error == SQLITE_OK;
+  }
+
+  template <typename T, typename Container>
+  void virtual_table<T, Container>::invalidate(void) noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_index_lock);
+    for(auto& positions : m_indexes)
+      positions.reset();
+  }
+
+  template <typename T, typename Container>
+  const std::vector<std::size_t>& virtual_table<T, Container>::index(int column)
+  {
+    std::lock_guard<std::mutex> lock(m_index_lock);
+    std::unique_ptr<std::vector<std::size_t>>& positions = m_indexes[column];
+    if(positions == nullptr)
+    {
+      positions = std::make_unique<std::vector<std::size_t>>(size());
+      for(std::size_t i = 0; i < positions->size(); ++i)
+        (*positions)[i] = i;
+      visit_column(column, [&](auto I)
+      {
+        std::stable_sort(positions->begin(), positions->end(), [&](std::size_t a, std::size_t b)
+          { return std::get<I>(members(row(a))) < std::get<I>(members(row(b))); });
+      });
+    }
+    return *positions;
+  }
+
+  // bounds only narrow the range, SQLite still checks every constraint on the rows returned
+  // so values it would compare differently (NULL, text against numbers, fractions
+  // against integers) can fall back to a wider range instead of giving wrong results
+  template <typename T, typename Container>
+  template <std::size_t I>
+  void virtual_table<T, Container>::narrow(cursor& position, int flags, sqlite3_value** values) const
+  {
+    using key = key_type<I>;
+    const std::vector<std::size_t>& order = *position.order;
+    auto first = order.begin() + position.current;
+    auto last = order.begin() + position.end;
+    auto less_than = [this](std::size_t p, const key& value) { return std::get<I>(members(row(p))) < value; };
+    auto greater_than = [this](const key& value, std::size_t p) { return value < std::get<I>(members(row(p))); };
+
+    auto comparable = [](sqlite3_value* value)
+    {
+      int type = sqlite3_value_numeric_type(value);
+      if constexpr (std::is_arithmetic_v<key> || std::is_enum_v<key>)
+        return type == SQLITE_INTEGER || type == SQLITE_FLOAT;
+      else
+        return type == SQLITE_TEXT;
+    };
+
+    // integer keys round a fractional bound outwards
+    auto bound = [](sqlite3_value* value, bool round_up) -> key
+    {
+      if constexpr (std::is_integral_v<key> || std::is_enum_v<key>)
+      {
+        if(sqlite3_value_type(value) == SQLITE_FLOAT)
+        {
+          using integer = typename std::conditional_t<std::is_enum_v<key>, std::underlying_type<key>, std::type_identity<key>>::type;
+          double real = round_up ? std::ceil(sqlite3_value_double(value)) : std::floor(sqlite3_value_double(value));
+          real = std::clamp(real, double(std::numeric_limits<integer>::lowest()), double(std::numeric_limits<integer>::max()));
+          return key(integer(real));
+        }
+      }
+      return detail::from_value<key>(value);
+    };
+
+    int arg = 0;
+    for(int flag : { int(equal), int(lower), int(upper) })
+    {
+      if((flags & flag) == 0)
+        continue;
+      sqlite3_value* value = values[arg++];
+      if(sqlite3_value_type(value) == SQLITE_NULL) // comparisons with NULL are never true
+        last = first;
+      if(!comparable(value) || first == last)
+        continue;
+      if(flag != upper)
+        first = std::lower_bound(first, last, bound(value, false), less_than);
+      if(flag != lower)
+        last = std::upper_bound(first, last, bound(value, true), greater_than);
+    }
+    position.current = first - order.begin();
+    position.end = std::max(first, last) - order.begin();
+  }
+
+  // rows a plan on the key returns, counted on its index when SQLite knows the values while planning
+  template <typename T, typename Container>
+  double virtual_table<T, Container>::estimate(int key, const std::array<int, 3>& args, sqlite3_index_info* info)
+  {
+    if(args[0] >= 0 && std::find(m_unique.begin(), m_unique.end(), key) != m_unique.end())
+      return 1;
+
+#if SQLITE_VERSION_NUMBER >= 3038000
+    std::array<sqlite3_value*, 3> values {};
+    const std::array<int, 3> flags { equal, lower, upper };
+    int plan = 0;
+    int count = 0;
+    bool known = true;
+    for(std::size_t i = 0; i < args.size() && known; ++i)
+    {
+      if(args[i] < 0 || (i > 0 && args[0] >= 0)) // an equality is looked up alone
+        continue;
+      known = sqlite3_vtab_rhs_value(info, args[i], &values[count++]) == SQLITE_OK;
+      plan |= flags[i];
+    }
+    if(known)
+    {
+      cursor position {};
+      position.order = &index(key);
+      position.end = size();
+      visit_column(key, [&](auto I) { if constexpr (indexable<I>) narrow<I>(position, plan, values.data()); });
+      return double(position.end - position.current);
+    }
+#else
+    (void)info;
+#endif
+
+    double rows = double(size()) + 1;
+    return args[0] >= 0 || (args[1] >= 0 && args[2] >= 0) ? rows / 16 :
+           args[1] >= 0 || args[2] >= 0 ? rows / 4 : rows;
+  }
+
+  template <typename T, typename Container>
+  const sqlite3_module* virtual_table<T, Container>::module(void) noexcept
+  {
+    static const sqlite3_module definition = []
+    {
+      sqlite3_module result {};
+      result.xConnect = connect; // without xCreate the module is an eponymous-only table
+      result.xBestIndex = best_index;
+      result.xDisconnect = disconnect;
+      result.xDestroy = disconnect;
+      result.xOpen = open;
+      result.xClose = close;
+      result.xFilter = filter;
+      result.xNext = next;
+      result.xEof = eof;
+      result.xColumn = column;
+      result.xRowid = rowid;
+      return result;
+    }();
+    return &definition;
+  }
+
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::connect(sqlite3* handle, void* aux, int, const char* const*, sqlite3_vtab** vtab, char** error) noexcept
+  {
+    virtual_table* self = static_cast<virtual_table*>(aux);
+    try
+    {
+      std::string schema = "CREATE TABLE x(";
+      for(int i = 0; i < int(arity); ++i)
+      {
+        visit_column(i, [&](auto I)
+        {
+          using key = key_type<I>;
+          const char* affinity = std::is_integral_v<key> || std::is_enum_v<key> ? "INTEGER" :
+                                 std::is_floating_point_v<key> ? "REAL" :
+                                 is_sql_view<key>::value && !is_string_view<key>::value ? "BLOB" :
+                                 std::is_same_v<key, std::vector<uint8_t>> ? "BLOB" : "TEXT";
+          schema.append(i ? ", \"" : "\"");
+          for(char ch : self->m_columns[I])
+            schema.append(ch == '"' ? 2 : 1, ch);
+          schema.append("\" ").append(affinity);
+        });
+      }
+      schema.append(")");
+
+      int rval = sqlite3_declare_vtab(handle, schema.c_str());
+      if(rval != SQLITE_OK)
+        return rval;
+      sqlite3_vtab_config(handle, SQLITE_VTAB_INNOCUOUS);
+
+      table* result = new table {};
+      result->owner = self;
+      *vtab = &result->base;
+      return SQLITE_OK;
+    }
+    catch(const std::bad_alloc&)
+    {
+      *error = sqlite3_mprintf("out of memory");
+      return SQLITE_NOMEM;
+    }
+  }
+
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::disconnect(sqlite3_vtab* vtab) noexcept
+  {
+    delete reinterpret_cast<table*>(vtab);
+    return SQLITE_OK;
+  }
+
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::best_index(sqlite3_vtab* vtab, sqlite3_index_info* info) noexcept
+  {
+    virtual_table& self = *reinterpret_cast<table*>(vtab)->owner;
+    double rows = double(self.size()) + 1;
+    double lookup = std::log2(rows) + 1;
+    int best_plan = 0;
+    double best_cost = rows;
+    double best_rows = rows;
+    std::array<int, 3> best_args { -1, -1, -1 };
+
+    for(int key : self.m_keys)
+    {
+      bool text = false;
+      visit_column(key, [&](auto I) { text = std::is_same_v<key_type<I>, std::string> || std::is_same_v<key_type<I>, std::string_view>; });
+
+      std::array<int, 3> args { -1, -1, -1 }; // equal, lower and upper bound constraints
+      for(int i = 0; i < info->nConstraint; ++i)
+      {
+        const auto& constraint = info->aConstraint[i];
+        if(!constraint.usable || constraint.iColumn != key)
+          continue;
+        // the index is in byte order, other collations may match rows outside its range
+        if(text && sqlite3_stricmp(sqlite3_vtab_collation(info, i), "BINARY") != 0)
+          continue;
+        switch(constraint.op)
+        {
+          case SQLITE_INDEX_CONSTRAINT_EQ: args[0] = i; break;
+          case SQLITE_INDEX_CONSTRAINT_GT:
+          case SQLITE_INDEX_CONSTRAINT_GE: args[1] = i; break;
+          case SQLITE_INDEX_CONSTRAINT_LT:
+          case SQLITE_INDEX_CONSTRAINT_LE: args[2] = i; break;
+        }
+      }
+
+      if(args[0] < 0 && args[1] < 0 && args[2] < 0)
+        continue;
+
+      double estimated = 0;
+      try
+      {
+        estimated = self.estimate(key, args, info);
+      }
+      catch(const std::bad_alloc&)
+      {
+        return SQLITE_NOMEM;
+      }
+
+      double cost = lookup + estimated;
+      if(cost < best_cost)
+      {
+        best_cost = cost;
+        best_rows = estimated;
+        best_args = args;
+        best_plan = key + 1;
+        if(args[0] >= 0)
+          best_args[1] = best_args[2] = -1;
+      }
+    }
+
+    // walking a key index in order lets SQLite skip its sort
+    if(info->nOrderBy == 1 && !info->aOrderBy[0].desc)
+    {
+      int key = info->aOrderBy[0].iColumn;
+      bool indexed = std::find(self.m_keys.begin(), self.m_keys.end(), key) != self.m_keys.end();
+      if(indexed && (best_plan == 0 || best_plan == key + 1))
+      {
+        best_plan = key + 1;
+        info->orderByConsumed = 1;
+      }
+    }
+
+    int arg = 0;
+    const std::array<int, 3> flags { equal, lower, upper };
+    for(std::size_t i = 0; i < best_args.size(); ++i)
+    {
+      if(best_args[i] < 0)
+        continue;
+      info->aConstraintUsage[best_args[i]].argvIndex = ++arg;
+      best_plan |= flags[i];
+    }
+
+    info->idxNum = best_plan;
+    info->estimatedCost = best_cost;
+    info->estimatedRows = sqlite3_int64(std::ceil(best_rows));
+    int key = (best_plan & 0xff) - 1;
+    if(best_args[0] >= 0 && std::find(self.m_unique.begin(), self.m_unique.end(), key) != self.m_unique.end())
+      info->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+    return SQLITE_OK;
+  }
+
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::open(sqlite3_vtab*, sqlite3_vtab_cursor** result) noexcept
+  {
+    cursor* position = new(std::nothrow) cursor {};
+    if(position == nullptr)
+      return SQLITE_NOMEM;
+    *result = &position->base;
+    return SQLITE_OK;
+  }
+
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::close(sqlite3_vtab_cursor* base) noexcept
+  {
+    delete reinterpret_cast<cursor*>(base);
+    return SQLITE_OK;
+  }
+
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::filter(sqlite3_vtab_cursor* base, int plan, const char*, int, sqlite3_value** values) noexcept
+  {
+    cursor& position = *reinterpret_cast<cursor*>(base);
+    virtual_table& self = *reinterpret_cast<table*>(base->pVtab)->owner;
+    position.order = nullptr;
+    position.current = 0;
+    position.end = self.size();
+
+    int key = (plan & 0xff) - 1;
+    if(key < 0)
+      return SQLITE_OK;
+
+    try
+    {
+      position.order = &self.index(key);
+      visit_column(key, [&](auto I) { if constexpr (indexable<I>) self.template narrow<I>(position, plan, values); });
+      return SQLITE_OK;
+    }
+    catch(const std::bad_alloc&)
+    {
+      return SQLITE_NOMEM;
+    }
+  }
+
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::next(sqlite3_vtab_cursor* base) noexcept
+  {
+    ++reinterpret_cast<cursor*>(base)->current;
+    return SQLITE_OK;
+  }
+
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::eof(sqlite3_vtab_cursor* base) noexcept
+  {
+    const cursor& position = *reinterpret_cast<cursor*>(base);
+    return position.current >= position.end;
+  }
+
+  // the container outlives the statement so values are handed over without a copy
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::column(sqlite3_vtab_cursor* base, sqlite3_context* context, int index) noexcept
+  {
+    sqlite3_int64 position = 0;
+    rowid(base, &position);
+    const virtual_table& self = *reinterpret_cast<table*>(base->pVtab)->owner;
+    visit_column(index, [&](auto I)
+    {
+      if constexpr (std::is_same_v<key_type<I>, std::wstring>)
+        detail::set_result(context, std::get<I>(members(self.row(position)))); // may be converted to UTF-16 first
+      else
+        detail::set_result(context, std::get<I>(members(self.row(position))), SQLITE_STATIC);
+    });
+    return SQLITE_OK;
+  }
+
+  template <typename T, typename Container>
+  int virtual_table<T, Container>::rowid(sqlite3_vtab_cursor* base, sqlite3_int64* result) noexcept
   {
-    throw_if_bad_field(SQLITE_FLOAT);
-    real = sqlite3_column_double(m_statement, m_field);
+    const cursor& position = *reinterpret_cast<cursor*>(base);
+    *result = position.order != nullptr ? (*position.order)[position.current] : position.current;
+    return SQLITE_OK;
   }
 }
 
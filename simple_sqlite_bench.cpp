@@ -0,0 +1,450 @@
+// Measures the cost of the sql:: wrapper against hand written sqlite3 C API code.
+//
+// build: g++ -std=c++20 -O2 -DNDEBUG simple_sqlite_bench.cpp simple_sqlite.cpp -lsqlite3 -o simple_sqlite_bench
+// usage: simple_sqlite_bench [rows] [on-disk database path], exits non-zero if the variants of
+// a scenario read back different data
+
+#include "simple_sqlite.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace
+{
+  using clock_type = std::chrono::steady_clock;
+
+  constexpr std::size_t blob_size = 4096;
+  constexpr std::size_t scan_length = 100;
+
+  struct bench_config
+  {
+    std::size_t rows;
+    std::size_t lookups;
+    std::string filename;
+  };
+
+  struct row_data
+  {
+    int64_t id;
+    std::string name;
+    double value;
+    std::vector<uint8_t> payload;
+  };
+
+  // times every operation individually so percentiles can be reported
+  // an operation may cover several rows, throughput is reported in rows
+  class recorder
+  {
+  public:
+    template <typename Operation>
+    void run(std::size_t iterations, Operation&& operation, std::size_t rows_per_operation = 1)
+    {
+      m_rows_per_operation = rows_per_operation;
+      m_latencies.clear();
+      m_latencies.reserve(iterations);
+      clock_type::time_point start = clock_type::now();
+      for(std::size_t pos = 0; pos < iterations; ++pos)
+      {
+        clock_type::time_point before = clock_type::now();
+        operation(pos);
+        m_latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - before).count());
+      }
+      m_elapsed = clock_type::now() - start;
+    }
+
+    void report(const char* database, const char* scenario, const char* variant)
+    {
+      std::sort(m_latencies.begin(), m_latencies.end());
+      auto percentile = [this](double fraction) -> uint64_t
+        { return m_latencies.empty() ? 0 : m_latencies[std::size_t(fraction * double(m_latencies.size() - 1))]; };
+
+      double seconds = std::chrono::duration<double>(m_elapsed).count();
+      std::printf("%-8s %-14s %-22s %12.0f ops/s  p50 %8lu ns  p90 %8lu ns  p99 %8lu ns  max %9lu ns\n",
+                  database, scenario, variant,
+                  seconds > 0 ? double(m_latencies.size() * m_rows_per_operation) / seconds : 0.0,
+                  percentile(0.50), percentile(0.90), percentile(0.99), percentile(1.0));
+    }
+
+  private:
+    std::vector<uint64_t> m_latencies;
+    clock_type::duration m_elapsed;
+    std::size_t m_rows_per_operation;
+  };
+
+  std::vector<row_data> make_rows(std::size_t count)
+  {
+    std::vector<row_data> rows(count);
+    for(std::size_t pos = 0; pos < count; ++pos)
+    {
+      rows[pos].id = int64_t(pos + 1);
+      rows[pos].name = "name_" + std::to_string(pos);
+      rows[pos].value = double(pos) * 0.25;
+      rows[pos].payload.assign(blob_size, uint8_t(pos));
+    }
+    return rows;
+  }
+
+  std::vector<int64_t> make_keys(std::size_t count, std::size_t rows)
+  {
+    std::mt19937_64 generator(42);
+    std::uniform_int_distribution<int64_t> distribution(1, int64_t(rows));
+    std::vector<int64_t> keys(count);
+    for(int64_t& key : keys)
+      key = distribution(generator);
+    return keys;
+  }
+
+  // every variant of a scenario has to read back the same data, or the timings compare different work
+  bool consistent = true;
+
+  template <typename T, std::size_t N>
+  void verify(const char* database, const char* scenario, const std::array<T, N>& checksums)
+  {
+    if(std::adjacent_find(checksums.begin(), checksums.end(), std::not_equal_to<>()) != checksums.end())
+    {
+      std::fprintf(stderr, "%s %s: variants read different data\n", database, scenario);
+      consistent = false;
+    }
+  }
+
+  int64_t row_count(sql::db& database)
+  {
+    int64_t count = 0;
+    sql::query select = database.build_query("SELECT count(*) FROM bench");
+    if(select.fetchRow())
+      select.getField(count);
+    return count;
+  }
+
+  bool reset_database(sql::db& database)
+  {
+    return database.execute("DROP TABLE IF EXISTS bench") &&
+           database.execute("CREATE TABLE bench(id INTEGER PRIMARY KEY, name TEXT, value REAL, payload BLOB)");
+  }
+
+  void bench_insert(const char* label, sql::db& database, const std::vector<row_data>& rows)
+  {
+    recorder timing;
+    sqlite3* handle = database.getHandle();
+    std::array<int64_t, 3> counts {};
+
+    reset_database(database);
+    database.execute("BEGIN");
+    timing.run(rows.size(), [&](std::size_t pos)
+    {
+      const row_data& row = rows[pos];
+      sql::query insert = database.build_query("INSERT INTO bench VALUES(?, ?, ?, ?)");
+      insert.arg(row.id).arg(row.name).arg(row.value).arg(row.payload);
+      insert.execute();
+    });
+    database.execute("COMMIT");
+    timing.report(label, "bulk insert", "wrapper");
+    counts[0] = row_count(database);
+
+    reset_database(database);
+    database.execute("BEGIN");
+    sqlite3_stmt* statement = nullptr;
+    sqlite3_prepare_v2(handle, "INSERT INTO bench VALUES(?, ?, ?, ?)", -1, &statement, NULL);
+    timing.run(rows.size(), [&](std::size_t pos)
+    {
+      const row_data& row = rows[pos];
+      sqlite3_bind_int64(statement, 1, row.id);
+      sqlite3_bind_text(statement, 2, row.name.data(), int(row.name.size()), SQLITE_TRANSIENT);
+      sqlite3_bind_double(statement, 3, row.value);
+      sqlite3_bind_blob(statement, 4, row.payload.data(), int(row.payload.size()), SQLITE_TRANSIENT);
+      sqlite3_step(statement);
+      sqlite3_reset(statement);
+    });
+    sqlite3_finalize(statement);
+    database.execute("COMMIT");
+    timing.report(label, "bulk insert", "raw");
+    counts[1] = row_count(database);
+
+    // executeBatch commits each chunk itself, latencies are per chunk
+    constexpr std::size_t chunk = 1000;
+    reset_database(database);
+    sql::query batch = database.build_query("INSERT INTO bench VALUES(?, ?, ?, ?)");
+    timing.run(rows.size() / chunk, [&](std::size_t pos)
+    {
+      batch.executeBatch(std::span<const row_data>(rows).subspan(pos * chunk, chunk), sql::batch_options { chunk, false });
+    }, chunk);
+    timing.report(label, "bulk insert", "wrapper executeBatch");
+    counts[2] = row_count(database);
+    verify(label, "bulk insert", counts);
+  }
+
+  void bench_lookup(const char* label, sql::db& database, const std::vector<int64_t>& keys)
+  {
+    recorder timing;
+    sqlite3* handle = database.getHandle();
+    std::array<std::size_t, 3> checksums {};
+
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      sql::query lookup = database.build_query("SELECT name, value FROM bench WHERE id = ?");
+      lookup.arg(keys[pos]);
+      std::string name;
+      std::optional<double> value;
+      if(lookup.fetchRow())
+        lookup.getField(name).getField(value);
+      checksums[0] += name.size() + std::size_t(value.value_or(0));
+    });
+    timing.report(label, "point lookup", "wrapper getField");
+
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      sql::query lookup = database.build_query("SELECT name, value FROM bench WHERE id = ?");
+      lookup.arg(keys[pos]);
+      for(auto [name, value] : lookup.rows<std::string_view, double>())
+        checksums[1] += name.size() + std::size_t(value);
+    });
+    timing.report(label, "point lookup", "wrapper rows<>");
+
+    sqlite3_stmt* statement = nullptr;
+    sqlite3_prepare_v2(handle, "SELECT name, value FROM bench WHERE id = ?", -1, &statement, NULL);
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      sqlite3_bind_int64(statement, 1, keys[pos]);
+      if(sqlite3_step(statement) == SQLITE_ROW)
+      {
+        sqlite3_column_text(statement, 0);
+        checksums[2] += std::size_t(sqlite3_column_bytes(statement, 0)) + std::size_t(sqlite3_column_double(statement, 1));
+      }
+      sqlite3_reset(statement);
+    });
+    sqlite3_finalize(statement);
+    timing.report(label, "point lookup", "raw");
+
+    verify(label, "point lookup", checksums);
+    if(checksums[0] == 0)
+      std::puts("no rows found");
+  }
+
+  void bench_scan(const char* label, sql::db& database, const std::vector<int64_t>& keys)
+  {
+    recorder timing;
+    sqlite3* handle = database.getHandle();
+    std::size_t iterations = std::max<std::size_t>(keys.size() / 10, 1);
+    std::array<double, 3> checksums {};
+
+    timing.run(iterations, [&](std::size_t pos)
+    {
+      sql::query scan = database.build_query("SELECT id, name, value FROM bench WHERE id BETWEEN ? AND ?");
+      scan.arg(keys[pos]).arg(keys[pos] + int64_t(scan_length));
+      for(auto [id, name, value] : scan.rows<int64_t, std::string_view, double>())
+        checksums[0] += double(id) + value + double(name.size());
+    });
+    timing.report(label, "range scan", "wrapper rows<>");
+
+    sql::column<int64_t> ids;
+    sql::column<std::string_view> names;
+    sql::column<double> values;
+    timing.run(iterations, [&](std::size_t pos)
+    {
+      sql::query scan = database.build_query("SELECT id, name, value FROM bench WHERE id BETWEEN ? AND ?");
+      scan.arg(keys[pos]).arg(keys[pos] + int64_t(scan_length));
+      std::size_t count = scan.fetchBatch(scan_length + 1, ids, names, values);
+      for(std::size_t row = 0; row < count; ++row)
+        checksums[1] += double(ids[row]) + values[row] + double(names[row].size());
+    });
+    timing.report(label, "range scan", "wrapper fetchBatch");
+
+    sqlite3_stmt* statement = nullptr;
+    sqlite3_prepare_v2(handle, "SELECT id, name, value FROM bench WHERE id BETWEEN ? AND ?", -1, &statement, NULL);
+    timing.run(iterations, [&](std::size_t pos)
+    {
+      sqlite3_bind_int64(statement, 1, keys[pos]);
+      sqlite3_bind_int64(statement, 2, keys[pos] + int64_t(scan_length));
+      while(sqlite3_step(statement) == SQLITE_ROW)
+      {
+        sqlite3_column_text(statement, 1);
+        checksums[2] += double(sqlite3_column_int64(statement, 0)) +
+                        sqlite3_column_double(statement, 2) +
+                        double(sqlite3_column_bytes(statement, 1));
+      }
+      sqlite3_reset(statement);
+    });
+    sqlite3_finalize(statement);
+    timing.report(label, "range scan", "raw");
+
+    verify(label, "range scan", checksums);
+    if(checksums[0] == 0)
+      std::puts("no rows found");
+  }
+
+  void bench_blob(const char* label, sql::db& database, const std::vector<int64_t>& keys)
+  {
+    recorder timing;
+    sqlite3* handle = database.getHandle();
+    std::vector<std::byte> buffer(blob_size);
+    std::array<std::size_t, 4> checksums {};
+
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      sql::query read = database.build_query("SELECT payload FROM bench WHERE id = ?");
+      read.arg(keys[pos]);
+      std::vector<uint8_t> payload;
+      if(read.fetchRow())
+        read.getField(payload);
+      checksums[0] += payload.size();
+    });
+    timing.report(label, "blob read", "wrapper vector");
+
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      sql::query read = database.build_query("SELECT payload FROM bench WHERE id = ?");
+      read.arg(keys[pos]);
+      for(std::span<const std::byte> payload : read.rows<std::span<const std::byte>>())
+        checksums[1] += payload.size();
+    });
+    timing.report(label, "blob read", "wrapper span");
+
+    sql::blob_stream stream;
+    stream.open(database, "bench", "payload", keys.front());
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      stream.reopen(keys[pos]);
+      checksums[2] += std::size_t(stream.read(buffer));
+    });
+    stream.close();
+    timing.report(label, "blob read", "wrapper blob_stream");
+
+    sqlite3_blob* blob = nullptr;
+    sqlite3_blob_open(handle, "main", "bench", "payload", keys.front(), 0, &blob);
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      sqlite3_blob_reopen(blob, keys[pos]);
+      sqlite3_blob_read(blob, buffer.data(), sqlite3_blob_bytes(blob), 0);
+      checksums[3] += std::size_t(sqlite3_blob_bytes(blob));
+    });
+    sqlite3_blob_close(blob);
+    timing.report(label, "blob read", "raw");
+
+    std::fill(buffer.begin(), buffer.end(), std::byte(0x5A));
+    database.execute("BEGIN");
+    stream.open(database, "bench", "payload", keys.front(), true);
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      stream.reopen(keys[pos]);
+      stream.write(buffer);
+    });
+    stream.close();
+    database.execute("COMMIT");
+    timing.report(label, "blob write", "wrapper blob_stream");
+
+    database.execute("BEGIN");
+    sqlite3_blob_open(handle, "main", "bench", "payload", keys.front(), 1, &blob);
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      sqlite3_blob_reopen(blob, keys[pos]);
+      sqlite3_blob_write(blob, buffer.data(), int(buffer.size()), 0);
+    });
+    sqlite3_blob_close(blob);
+    database.execute("COMMIT");
+    timing.report(label, "blob write", "raw");
+
+    verify(label, "blob read", checksums);
+    if(checksums[0] == 0)
+      std::puts("no blobs found");
+  }
+
+  // nine reads to every write, each write in its own transaction
+  void bench_mixed(const char* label, sql::db& database, const std::vector<int64_t>& keys)
+  {
+    recorder timing;
+    sqlite3* handle = database.getHandle();
+    double checksum = 0;
+
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      if(pos % 10 == 9)
+      {
+        sql::query update = database.build_query("UPDATE bench SET value = value + 1 WHERE id = ?");
+        update.arg(keys[pos]);
+        update.execute();
+      }
+      else
+      {
+        sql::query lookup = database.build_query("SELECT value FROM bench WHERE id = ?");
+        lookup.arg(keys[pos]);
+        for(double value : lookup.rows<double>())
+          checksum += value;
+      }
+    });
+    timing.report(label, "mixed 90/10", "wrapper");
+
+    sqlite3_stmt* update = nullptr;
+    sqlite3_stmt* lookup = nullptr;
+    sqlite3_prepare_v2(handle, "UPDATE bench SET value = value + 1 WHERE id = ?", -1, &update, NULL);
+    sqlite3_prepare_v2(handle, "SELECT value FROM bench WHERE id = ?", -1, &lookup, NULL);
+    timing.run(keys.size(), [&](std::size_t pos)
+    {
+      sqlite3_stmt* statement = pos % 10 == 9 ? update : lookup;
+      sqlite3_bind_int64(statement, 1, keys[pos]);
+      while(sqlite3_step(statement) == SQLITE_ROW)
+        checksum += sqlite3_column_double(statement, 0);
+      sqlite3_reset(statement);
+    });
+    sqlite3_finalize(update);
+    sqlite3_finalize(lookup);
+    timing.report(label, "mixed 90/10", "raw");
+
+    if(checksum == 0)
+      std::puts("no rows found");
+  }
+
+  bool run_suite(const char* label, const std::string& filename, const bench_config& config)
+  {
+    sql::db database;
+    if(!database.open(filename))
+    {
+      std::fprintf(stderr, "unable to open %s: %s\n", filename.c_str(), sqlite3_errstr(database.lastError()));
+      return false;
+    }
+
+    database.execute("PRAGMA journal_mode=WAL");
+    std::vector<row_data> rows = make_rows(config.rows);
+    std::vector<int64_t> keys = make_keys(config.lookups, config.rows);
+
+    bench_insert(label, database, rows);
+    bench_lookup(label, database, keys);
+    bench_scan(label, database, keys);
+    bench_blob(label, database, keys);
+    bench_mixed(label, database, keys);
+    database.execute("DROP TABLE bench");
+    return true;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  bench_config config;
+  config.rows = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+  config.rows = (config.rows + 999) / 1000 * 1000; // whole executeBatch chunks
+  config.lookups = std::max<std::size_t>(config.rows, 1000);
+  config.filename = argc > 2 ? argv[2] : "simple_sqlite_bench.db";
+
+  if(config.rows == 0)
+  {
+    std::fprintf(stderr, "usage: %s [rows] [on-disk database path]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  bool ok = run_suite("memory", ":memory:", config) &&
+            run_suite("disk", config.filename, config);
+
+  std::remove(config.filename.c_str());
+  std::remove((config.filename + "-wal").c_str());
+  std::remove((config.filename + "-shm").c_str());
+  return ok && consistent ? EXIT_SUCCESS : EXIT_FAILURE;
+}
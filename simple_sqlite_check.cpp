@@ -0,0 +1,868 @@
+// Executable checks for behaviour of the sql:: wrapper that is easy to break and hard to spot.
+//
+// build: g++ -std=c++20 -g -fsanitize=address,undefined simple_sqlite_check.cpp simple_sqlite.cpp -lsqlite3 -o simple_sqlite_check
+// session checks: add -DSQLITE_ENABLE_SESSION -DSQLITE_ENABLE_PREUPDATE_HOOK, the SQLite library must have them too
+// usage: simple_sqlite_check, exits non-zero if any check fails
+
+#include "simple_sqlite.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  int failures = 0;
+
+  void check(bool condition, const char* what)
+  {
+    if(!condition)
+    {
+      std::fprintf(stderr, "FAIL: %s\n", what);
+      ++failures;
+    }
+  }
+
+  template <typename T>
+  T select_one(sql::db& database, const char* sql_str)
+  {
+    sql::query select = database.build_query(sql_str);
+    T result {};
+    if(select.fetchRow())
+      select.getField(result);
+    return result;
+  }
+
+  // runs first: the allocator and page cache can only be installed before SQLite initializes,
+  // every later check then runs on them
+  void check_allocator(void)
+  {
+    check(sql::install_allocator({ .max_small_size = 1 << 20, .cached_blocks = 16 }), "allocator: install before initialization");
+    check(sql::install_page_cache({ .slots = 64 }), "page cache: install before initialization");
+
+    sql::db database;
+    database.open(":memory:");
+    database.execute("CREATE TABLE pages(data BLOB);"
+                     "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 1000)"
+                     "INSERT INTO pages SELECT randomblob(1000) FROM n");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM pages") == 1000, "allocator: queries run on it");
+
+    sql::allocator_stats memory = sql::allocator_statistics();
+    check(memory.bytes_in_use > 0 && memory.bytes_in_use >= memory.bytes_requested, "allocator: statistics");
+    sql::page_cache_stats pages = sql::page_cache_statistics();
+    check(pages.slots == 64 && pages.slots_in_use > 0 && pages.heap_pages > 0, "page cache: pages beyond the arena go to the heap");
+
+    check(!sql::install_allocator(), "allocator: refused after initialization");
+    check(!sql::install_page_cache(), "page cache: refused after initialization");
+  }
+
+  // statements come back from the cache reset and unbound, LRU order decides evictions
+  void check_statement_cache(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    database.setStatementCacheSize(2);
+
+    for(int64_t value : { 1, 2 })
+    {
+      sql::query bound = database.build_query("SELECT ?1");
+      bound.arg(value);
+      int64_t result = 0;
+      if(bound.fetchRow())
+        bound.getField(result);
+      check(result == value, "statement cache: a reused statement takes new arguments");
+    }
+    check(database.statementCacheStats().hits == 1, "statement cache: the same SQL text is a hit");
+
+    check(select_one<int64_t>(database, "SELECT 10") == 10 && select_one<int64_t>(database, "SELECT 20") == 20,
+          "statement cache: distinct statements");
+    check(database.statementCacheStats().evictions == 1, "statement cache: least recently used statement evicted");
+
+    {
+      sql::query first = database.build_query("SELECT 30");
+      sql::query second = database.build_query("SELECT 30"); // the first holds the cached copy
+      check(first.fetchRow() && second.fetchRow(), "statement cache: identical statements checked out together");
+    }
+
+    std::optional<sql::query> outliving;
+    {
+      sql::db temporary;
+      temporary.open(":memory:");
+      outliving = temporary.build_query("SELECT 1");
+    }
+    outliving.reset(); // finalizes instead of returning to the destroyed db
+  }
+
+  // batches commit chunk by chunk, savepoint chunks skip only the chunk that failed
+  // and inside an open transaction the chunks nest in it
+  void check_execute_batch(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    database.execute("CREATE TABLE batch(value INTEGER UNIQUE)");
+
+    std::vector<int64_t> values { 1, 2, 3, 4, 5 };
+    sql::query insert = database.build_query("INSERT INTO batch VALUES(?)");
+    check(insert.executeBatch(values, { .chunk_size = 2 }) == 5, "executeBatch: every row committed");
+
+    std::vector<int64_t> clashing { 6, 7, 1, 8, 9 }; // the second chunk fails
+    sql::query retry = database.build_query("INSERT INTO batch VALUES(?)");
+    check(retry.executeBatch(clashing, { .chunk_size = 2, .savepoint_per_chunk = true }) == 3 &&
+          (retry.lastError() & 0xff) == SQLITE_CONSTRAINT, "executeBatch: a failed savepoint chunk is skipped");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM batch") == 8, "executeBatch: rows of the failed chunk rolled back");
+
+    database.execute("BEGIN");
+    std::vector<int64_t> nested { 20, 21, 22 };
+    sql::query inner = database.build_query("INSERT INTO batch VALUES(?)");
+    check(inner.executeBatch(nested, { .chunk_size = 2 }) == 3, "executeBatch: chunks inside an open transaction");
+    database.execute("ROLLBACK");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM batch") == 8, "executeBatch: nested chunks roll back with the transaction");
+
+    sql::query reused = database.build_query("SELECT ?1 + 1");
+    reused.arg(int64_t(41));
+    int64_t first = 0, second = 0;
+    if(reused.fetchRow())
+      reused.getField(first);
+    reused.reset();
+    if(reused.fetchRow())
+      reused.getField(second);
+    check(first == 42 && second == 42, "query: reset keeps the bound arguments");
+  }
+
+  // views read the column in place, embedded NULs and empty values included
+  void check_field_views(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    sql::query select = database.build_query("SELECT CAST(X'610062' AS TEXT), X'00ff01', 'hé', '', X''");
+
+    std::string_view text, empty_text;
+    std::span<const std::byte> blob, empty_blob;
+    std::u16string_view wide;
+    if(select.fetchRow())
+      select.getField(text).getField(blob).getField(wide).getField(empty_text).getField(empty_blob);
+    check(text == std::string_view("a\0b", 3), "getField: string_view with an embedded NUL");
+    check(blob.size() == 3 && blob[0] == std::byte(0x00) && blob[1] == std::byte(0xff) && blob[2] == std::byte(0x01),
+          "getField: span over a blob");
+    check(wide == u"hé", "getField: u16string_view");
+    check(empty_text.empty() && empty_blob.empty(), "getField: empty views");
+  }
+
+  struct person
+  {
+    int64_t id;
+    std::string name;
+    std::optional<double> score;
+  };
+
+  // typed rows decode tuples, structs and NULLs, and still refuse a mismatched column type
+  void check_typed_rows(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    database.execute("CREATE TABLE people(id INTEGER, name TEXT, score REAL);"
+                     "INSERT INTO people VALUES(1, 'ann', 2.5), (2, 'bob', NULL)");
+
+    std::vector<person> people;
+    for(person& row : database.build_query("SELECT id, name, score FROM people ORDER BY id").rows<person>())
+      people.push_back(row);
+    check(people.size() == 2 && people[0].name == "ann" && people[0].score == 2.5 && !people[1].score,
+          "rows<>: plain structs with a NULL optional");
+
+    int64_t total = 0;
+    sql::query tuples = database.build_query("SELECT id, name FROM people");
+    for(auto [id, name] : tuples.rows<int64_t, std::string_view>())
+      total += id + int64_t(name.size());
+    check(total == 9, "rows<>: tuples with views");
+
+    bool thrown = false;
+    try
+    {
+      for(double score : database.build_query("SELECT name FROM people").rows<double>())
+        (void)score;
+    }
+    catch(const std::string&) { thrown = true; }
+    check(thrown, "rows<>: a mismatched column type throws");
+
+    sql::query insert = database.build_query("INSERT INTO people VALUES(?, ?, ?)");
+    insert.arg(person { 3, "cy", std::nullopt }).execute();
+    check(select_one<int64_t>(database, "SELECT count(*) FROM people WHERE id = 3 AND score IS NULL") == 1,
+          "arg: binds every member of a struct");
+  }
+
+  // a scratch database file, removed with its WAL and shared memory files
+  struct scratch_file
+  {
+    std::string path;
+
+    explicit scratch_file(const char* name)
+      : path((std::filesystem::temp_directory_path() / name).string()) { remove(); }
+    ~scratch_file(void) { remove(); }
+
+    void remove(void)
+    {
+      for(const char* suffix : { "", "-wal", "-shm", "-journal" })
+        std::filesystem::remove(path + suffix);
+    }
+  };
+
+  // readers share the pool between threads and see what the writer committed, not more
+  void check_pool(void)
+  {
+    scratch_file file("simple_sqlite_check_pool.db");
+    sql::pool connections;
+    check(connections.open(file.path, 2), "pool: open");
+    check(connections.writer()->execute("CREATE TABLE items(value INTEGER); INSERT INTO items VALUES(1), (2)"), "pool: writer");
+
+    {
+      sql::pool::connection writer = connections.writer();
+      writer->execute("BEGIN; INSERT INTO items VALUES(3)");
+      check(select_one<int64_t>(*connections.reader(), "SELECT count(*) FROM items") == 2, "pool: readers don't see uncommitted writes");
+      writer->execute("COMMIT");
+    }
+
+    std::atomic<int> seen { 0 };
+    std::vector<std::thread> threads;
+    for(int thread = 0; thread < 4; ++thread) // more threads than readers
+      threads.emplace_back([&connections, &seen]
+      {
+        for(int pos = 0; pos < 50; ++pos)
+          seen += int(select_one<int64_t>(*connections.reader(), "SELECT count(*) FROM items"));
+      });
+    for(std::thread& thread : threads)
+      thread.join();
+    check(seen == 4 * 50 * 3, "pool: readers shared between threads");
+    check(connections.close(), "pool: close");
+  }
+
+  // posts racing with stop() must each complete exactly once, committed or refused
+  void check_async_writer_stop(void)
+  {
+    constexpr int rounds = 50;
+    constexpr int threads = 4;
+    constexpr int posts = 200;
+
+    bool all_completed = true;
+    for(int round = 0; round < rounds; ++round)
+    {
+      sql::db database;
+      database.open(":memory:");
+      database.execute("CREATE TABLE writes(value INTEGER)");
+
+      sql::async_writer writer;
+      writer.start(database);
+
+      std::atomic<int> completed { 0 };
+      std::vector<std::thread> posters;
+      for(int thread = 0; thread < threads; ++thread)
+        posters.emplace_back([&writer, &completed]
+        {
+          for(int pos = 0; pos < posts; ++pos)
+            writer.post([&completed](int) { ++completed; }, "INSERT INTO writes VALUES(?)", pos);
+        });
+      std::this_thread::sleep_for(std::chrono::microseconds(50 * round));
+      writer.stop();
+      for(std::thread& poster : posters)
+        poster.join();
+
+      all_completed = all_completed && completed == threads * posts;
+    }
+    check(all_completed, "async_writer: every post completes when stop() races with it");
+  }
+
+  std::string blob_contents(sql::db& database)
+  {
+    sql::query contents = database.build_query("SELECT CAST(data AS TEXT) FROM blobs");
+    std::string text;
+    if(contents.fetchRow())
+      contents.getField(text);
+    return text;
+  }
+
+  // the writer only lingers for more writes while a commit has room for them
+  void check_async_writer_linger(void)
+  {
+    using namespace std::chrono;
+    sql::db database;
+    database.open(":memory:");
+    database.execute("CREATE TABLE writes(value INTEGER)");
+
+    sql::async_writer writer;
+    writer.start(database, { .max_batch = 1, .max_delay = seconds(2) });
+    std::atomic<bool> done { false };
+    steady_clock::time_point posted = steady_clock::now();
+    writer.post([&done](int) { done = true; }, "INSERT INTO writes VALUES(1)");
+    while(!done && steady_clock::now() - posted < seconds(5))
+      std::this_thread::sleep_for(milliseconds(1));
+    check(done && steady_clock::now() - posted < seconds(1), "async_writer: a full batch commits without lingering");
+    writer.stop();
+
+    writer.start(database, { .max_batch = 1024, .max_delay = seconds(2) });
+    std::this_thread::sleep_for(milliseconds(10));
+    steady_clock::time_point stopping = steady_clock::now();
+    writer.post(nullptr, "INSERT INTO writes VALUES(2)");
+    writer.stop();
+    check(steady_clock::now() - stopping < seconds(1) && select_one<int64_t>(database, "SELECT count(*) FROM writes") == 2,
+          "async_writer: stop() doesn't wait out the linger");
+  }
+
+  // batches fill the column buffers a page at a time, NULLs only clear the validity bit
+  void check_fetch_batch(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    database.execute("CREATE TABLE samples(id INTEGER, value REAL, label TEXT);"
+                     "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 100)"
+                     "INSERT INTO samples SELECT i, CASE WHEN i % 10 = 0 THEN NULL ELSE i * 0.5 END, 'l' || i FROM n");
+
+    sql::column<int64_t> ids;
+    sql::column<double> values;
+    sql::column<std::string_view> labels;
+    sql::query select = database.build_query("SELECT id, value, label FROM samples ORDER BY id");
+
+    std::size_t total = 0;
+    bool consistent = true;
+    for(std::size_t fetched; (fetched = select.fetchBatch(64, ids, values, labels)) > 0; total += fetched)
+    {
+      consistent = consistent && ids.size() == fetched && values.size() == fetched && labels.size() == fetched;
+      for(std::size_t row = 0; row < fetched && consistent; ++row)
+      {
+        int64_t id = ids[row];
+        consistent = values.isNull(row) == (id % 10 == 0) &&
+                     (values.isNull(row) ? values[row] == 0 : values[row] == double(id) * 0.5) &&
+                     labels[row] == "l" + std::to_string(id);
+      }
+    }
+    check(total == 100 && consistent, "fetchBatch: values, NULLs and text across batches");
+  }
+
+  // sequential reads stop at the end of the blob, writes can't grow it
+  void check_blob_stream(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    database.execute("CREATE TABLE blobs(data BLOB); INSERT INTO blobs VALUES(zeroblob(6)); INSERT INTO blobs VALUES(X'0102')");
+    int64_t second = database.lastInsertRowId();
+
+    sql::blob_stream blob;
+    check(blob.open(database, "blobs", "data", 1, true) && blob.size() == 6, "blob_stream: open");
+    const std::byte text[] = { std::byte('a'), std::byte('b'), std::byte('c'), std::byte('d') };
+    check(blob.write(text) == 4 && blob.tell() == 4, "blob_stream: sequential write");
+    check(blob.write(text) == 2, "blob_stream: writes stop at the end");
+    check(!blob.writeAt(text, 4), "blob_stream: random writes can't grow the blob");
+
+    std::byte buffer[8] {};
+    check(blob.seek(2) && blob.read(buffer) == 4 && buffer[0] == std::byte('c') && buffer[3] == std::byte('b'),
+          "blob_stream: reads stop at the end");
+    check(blob.reopen(second) && blob.size() == 2 && blob.readAt(std::span(buffer, 2), 0) && buffer[1] == std::byte(0x02),
+          "blob_stream: reopen on another row");
+  }
+
+  // reads and writes through one streambuf land where the stream position says
+  void check_blob_mixed_io(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    database.execute("CREATE TABLE blobs(data BLOB); INSERT INTO blobs VALUES(CAST('abcdefgh' AS BLOB))");
+
+    {
+      sql::blob_stream blob;
+      blob.open(database, "blobs", "data", database.lastInsertRowId(), true);
+      sql::blob_streambuf buffer(blob, 4);
+      std::iostream io(&buffer);
+
+      io.get();
+      io.put('X'); // after a read, with the rest of the chunk read ahead
+      io.flush();
+      check(io.tellg() == 2, "blob_streambuf: position advances past a write after a read");
+      check(io.get() == 'c', "blob_streambuf: a read after a write continues after it");
+
+      io.seekp(6);
+      io.put('Y').put('Z'); // left for the destructor to flush
+    }
+    check(blob_contents(database) == "aXcdefYZ", "blob_streambuf: mixed reads and writes");
+  }
+
+  // statements differing only in literals share one profile, parameters and exponents stay whole
+  void check_profiling(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    std::vector<std::string> executed;
+    check(database.enableProfiling([&executed](const sql::statement_execution& run) { executed.emplace_back(run.sql); }),
+          "profiling: enable");
+    database.execute("CREATE TABLE numbers(value REAL, name TEXT)");
+    database.execute("INSERT INTO numbers VALUES(1e+5, 'a')");
+    database.execute("INSERT INTO numbers VALUES(2.5E-3, 'it''s')");
+    for(int64_t value : { 1, 2 })
+    {
+      sql::query select = database.build_query("SELECT value FROM numbers WHERE rowid = ?1 AND name <> :name AND value > 0x1F");
+      select.arg(value).arg(std::string("x"));
+      while(select.fetchRow());
+    }
+
+    std::vector<sql::statement_profile> profiles = database.profileSnapshot();
+    auto calls = [&profiles](const char* sql_str)
+    {
+      for(const sql::statement_profile& profile : profiles)
+        if(profile.sql == sql_str)
+          return profile.calls;
+      return uint64_t(0);
+    };
+    check(calls("INSERT INTO numbers VALUES(?, ?)") == 2, "profiling: literals and signed exponents normalized");
+    check(calls("SELECT value FROM numbers WHERE rowid = ?1 AND name <> :name AND value > ?") == 2, "profiling: parameters kept");
+    check(executed.size() == 5, "profiling: callback after every execution");
+    database.disableProfiling();
+  }
+
+  // snapshots copy the whole database, a source another connection keeps locked fails after busy_timeout
+  void check_backup(void)
+  {
+    using namespace std::chrono;
+    scratch_file file("simple_sqlite_check_backup.db");
+    sql::db source;
+    source.open(file.path);
+    source.execute("CREATE TABLE items(value INTEGER);"
+                   "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 1000)"
+                   "INSERT INTO items SELECT i FROM n");
+
+    sql::db copy;
+    copy.open(":memory:");
+    int progress_calls = 0;
+    sql::backup_options options;
+    options.pages_per_step = 1;
+    options.progress = [&progress_calls](int, int) { ++progress_calls; return true; };
+    check(source.snapshot_to(copy, options) && select_one<int64_t>(copy, "SELECT sum(value) FROM items") == 500500,
+          "backup: snapshot to another connection");
+    check(progress_calls > 1, "backup: progress reported per step");
+
+    sql::db memory;
+    memory.open(file.path);
+    check(memory.load_into_memory() && select_one<int64_t>(memory, "SELECT count(*) FROM items") == 1000,
+          "backup: load into memory");
+    memory.execute("DELETE FROM items");
+    check(select_one<int64_t>(source, "SELECT count(*) FROM items") == 1000, "backup: the in-memory copy is detached from the file");
+
+    sql::db locker;
+    locker.open(file.path);
+    locker.execute("BEGIN EXCLUSIVE");
+    options.busy_timeout = milliseconds(100);
+    steady_clock::time_point start = steady_clock::now();
+    check(!source.snapshot_to(copy, options) && (source.lastError() & 0xff) == SQLITE_BUSY &&
+          steady_clock::now() - start < seconds(2), "backup: a locked source fails with SQLITE_BUSY");
+    locker.execute("ROLLBACK");
+  }
+
+  // sums integers, skipping NULLs, with inverse() for sliding windows
+  struct checked_sum
+  {
+    int64_t total = 0;
+    void step(std::optional<int64_t> value) { total += value.value_or(0); }
+    void inverse(std::optional<int64_t> value) { total -= value.value_or(0); }
+    int64_t value(void) const { return total; }
+  };
+
+  // the checkpointer takes over WAL checkpoints while running and hands the target's
+  // own auto-checkpoint setting back when it stops
+  void check_checkpointer(void)
+  {
+    using namespace std::chrono_literals;
+    sql::checkpointer idle;
+    sql::db memory;
+    memory.open(":memory:");
+    check(!idle.start(memory) && idle.lastError() == SQLITE_MISUSE, "checkpointer: refuses an in-memory database");
+
+    scratch_file file("simple_sqlite_check_checkpoint.db");
+    sql::db writer;
+    writer.open(file.path);
+    writer.execute("CREATE TABLE log(value BLOB)");
+    check(!idle.start(writer) && idle.lastError() == SQLITE_MISUSE, "checkpointer: refuses a rollback journal");
+
+    writer.execute("PRAGMA journal_mode = WAL; PRAGMA wal_autocheckpoint = 123");
+    sql::checkpointer background;
+    check(background.start(writer, { .passive_frames = 10, .idle_time = 20ms, .poll_interval = 5ms }), "checkpointer: start");
+    check(select_one<int64_t>(writer, "PRAGMA wal_autocheckpoint") == 0, "checkpointer: replaces the auto-checkpoint");
+
+    sql::query insert = writer.build_query("INSERT INTO log VALUES(randomblob(2000))");
+    for(int commit = 0; commit < 50; ++commit)
+    {
+      insert.execute();
+      insert.reset();
+    }
+    std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + 5s;
+    while(background.stats().frames_checkpointed == 0 && std::chrono::steady_clock::now() < until)
+      std::this_thread::sleep_for(5ms);
+    sql::checkpoint_stats stats = background.stats();
+    check(stats.passive > 0 && stats.frames_checkpointed > 0 && stats.errors == 0, "checkpointer: checkpoints the backlog");
+
+    background.stop();
+    check(select_one<int64_t>(writer, "PRAGMA wal_autocheckpoint") == 123, "checkpointer: stop restores the previous auto-checkpoint");
+  }
+
+  // a locked database is retried until the lock goes away or max_wait runs out, and
+  // immediate_transactions only rewrites a plain or deferred BEGIN
+  void check_busy_policy(void)
+  {
+    using namespace std::chrono_literals;
+    scratch_file file("simple_sqlite_check_busy.db");
+    sql::db holder;
+    sql::db waiter;
+    check(holder.open(file.path) && waiter.open(file.path), "busy: open");
+    holder.execute("CREATE TABLE log(value INTEGER)");
+
+    waiter.setBusyPolicy({ .initial_delay = 100us, .max_delay = 1ms, .max_wait = 20ms });
+    holder.execute("BEGIN IMMEDIATE");
+    check(!waiter.execute("INSERT INTO log VALUES(1)") && waiter.lastError() == SQLITE_BUSY, "busy: gives up after max_wait");
+    check(waiter.lockWaitStats().timeouts == 1 && waiter.lockWaitStats().retries > 0, "busy: a timeout is counted");
+
+    waiter.resetLockWaitStats();
+    waiter.setBusyPolicy({ .initial_delay = 100us, .max_delay = 1ms, .max_wait = 5000ms });
+    std::thread release([&holder] { std::this_thread::sleep_for(30ms); holder.execute("COMMIT"); });
+    bool inserted = waiter.execute("INSERT INTO log VALUES(2)");
+    release.join();
+    const sql::lock_wait_stats& waits = waiter.lockWaitStats();
+    check(inserted, "busy: succeeds once the lock is released");
+    check(waits.waits == 1 && waits.timeouts == 0 && waits.max_ns >= 10'000'000 && waits.total_ns == waits.max_ns, "busy: the wait is measured");
+
+    waiter.setBusyPolicy({ .max_wait = 0ms, .immediate_transactions = true });
+    for(const char* begin : { "BEGIN", "begin deferred transaction;", " Begin Transaction " })
+    {
+      check(waiter.execute(begin), "busy: BEGIN with immediate_transactions");
+      check(!holder.execute("BEGIN IMMEDIATE") && holder.lastError() == SQLITE_BUSY, "busy: BEGIN is rewritten to BEGIN IMMEDIATE");
+      waiter.execute("COMMIT");
+    }
+
+    check(waiter.execute("BEGIN; INSERT INTO log VALUES(3); COMMIT"), "busy: BEGIN followed by statements");
+    check(select_one<int64_t>(holder, "SELECT count(*) FROM log") == 2, "busy: statements after BEGIN aren't dropped");
+  }
+
+  // runaway statements stop with sql::timed_out, the connection timeout covering a whole run
+  // rather than each step, and a query deadline overriding it
+  void check_deadline(void)
+  {
+    using namespace std::chrono_literals;
+    const char* endless = "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n) SELECT i FROM n";
+
+    sql::db database;
+    database.open(":memory:");
+    database.setDeadlineGranularity(100);
+    database.setTimeout(20ms);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    check(!database.execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n) SELECT count(*) FROM n") &&
+          database.lastError() == sql::timed_out, "deadline: execute times out");
+
+    sql::query rows = database.build_query(endless);
+    std::size_t fetched = 0;
+    while(rows.fetchRow())
+      ++fetched;
+    check(fetched > 0 && rows.lastError() == sql::timed_out, "deadline: a run of quick steps shares one timeout");
+    check(!rows.fetchRow() && rows.lastError() == sql::timed_out, "deadline: a timed out query isn't restarted");
+    check(std::chrono::steady_clock::now() - start < 5s, "deadline: statements stop soon after it");
+
+    check(select_one<int64_t>(database, "SELECT 42") == 42, "deadline: quick statements still run");
+
+    database.setTimeout(0ns);
+    sql::query limited = database.build_query(endless);
+    limited.setTimeout(20ms);
+    while(limited.fetchRow()) { }
+    check(limited.lastError() == sql::timed_out, "deadline: a query deadline without a connection timeout");
+
+    const sql::deadline_stats& stats = database.deadlineStats();
+    check(stats.timeouts == 3 && stats.armed > stats.timeouts && stats.checks > 0, "deadline: statistics");
+  }
+
+  // scalar functions marshal their arguments and results, aggregates keep state per group
+  void check_functions(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    check(database.register_function("scale", [](double value, int64_t factor) { return value * double(factor); }, SQLITE_DETERMINISTIC),
+          "functions: register scalar");
+    check(database.register_function("maybe", [](std::optional<int64_t> value) { return value ? std::optional<int64_t>(*value + 1) : std::nullopt; }),
+          "functions: register with optionals");
+    check(database.register_aggregate<checked_sum>("checked_sum"), "functions: register aggregate");
+
+    check(select_one<double>(database, "SELECT scale(1.5, 4)") == 6.0, "functions: scalar arguments and result");
+    check(select_one<int64_t>(database, "SELECT maybe(NULL) IS NULL AND maybe(1) = 2"), "functions: NULL arguments and results");
+
+    database.execute("CREATE TABLE numbers(grp INTEGER, value INTEGER);"
+                     "INSERT INTO numbers VALUES(1, 1), (1, 2), (1, NULL), (2, 10), (2, 20)");
+    check(select_one<std::string>(database, "SELECT group_concat(total) FROM (SELECT checked_sum(value) AS total FROM numbers GROUP BY grp ORDER BY grp)") == "3,30",
+          "functions: aggregate state per group");
+    check(select_one<std::string>(database, "SELECT group_concat(running) FROM (SELECT checked_sum(value) OVER (ORDER BY rowid ROWS 1 PRECEDING) AS running FROM numbers)") == "1,3,2,10,30",
+          "functions: aggregate window with inverse");
+    check(select_one<double>(database, "SELECT scale('2.5', '2')") == 5.0, "functions: text arguments convert like SQLite casts");
+  }
+
+#ifdef SQLITE_ENABLE_SESSION
+  // changes recorded on one database replay on another, conflicts reach the handler
+  // and a take starts a new capture window
+  void check_session(void)
+  {
+    const char* schema = "CREATE TABLE kv(key INTEGER PRIMARY KEY, value TEXT); CREATE TABLE skipped(key INTEGER PRIMARY KEY)";
+    sql::db source;
+    sql::db target;
+    source.open(":memory:");
+    target.open(":memory:");
+    source.execute(schema);
+    target.execute(schema);
+
+    sql::session capture;
+    check(capture.open(source) && capture.attach(), "session: open and attach every table");
+    source.execute("INSERT INTO kv VALUES(1, 'one'), (2, 'two'); INSERT INTO skipped VALUES(1); UPDATE kv SET value = 'uno' WHERE key = 1");
+
+    std::vector<uint8_t> changes;
+    check(capture.takeChangeset(changes) && !changes.empty() && capture.empty(), "session: take a changeset");
+    check(target.applyChangeset(changes, nullptr, [](std::string_view table) { return table == "kv"; }), "session: apply a changeset");
+    check(select_one<std::string>(target, "SELECT group_concat(value) FROM (SELECT value FROM kv ORDER BY key)") == "uno,two" &&
+          select_one<int64_t>(target, "SELECT count(*) FROM skipped") == 0, "session: the filter picks the tables");
+
+    source.execute("UPDATE kv SET value = 'dos' WHERE key = 2");
+    target.execute("UPDATE kv SET value = 'deux' WHERE key = 2");
+    check(capture.changeset(changes) && !changes.empty(), "session: changes after a take");
+    check(!target.applyChangeset(changes) && select_one<std::string>(target, "SELECT value FROM kv WHERE key = 2") == "deux",
+          "session: a conflict without a handler aborts");
+
+    std::string existing;
+    auto replace = [&existing](const sql::changeset_conflict& conflict)
+    {
+      if(conflict.type() == SQLITE_CHANGESET_DATA && conflict.operation() == SQLITE_UPDATE && conflict.table() == "kv")
+        existing = conflict.existing<std::string>(1).value_or("");
+      return sql::conflict_action::replace;
+    };
+    check(target.applyChangeset(changes, replace) && existing == "deux" &&
+          select_one<std::string>(target, "SELECT value FROM kv WHERE key = 2") == "dos", "session: a handler replaces the row");
+  }
+#endif
+
+  // wide and UTF-16 strings pass through user functions intact, including outside the BMP
+  void check_function_strings(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    database.register_function("wlen", [](const std::wstring& text) { return int64_t(text.size()); });
+    database.register_function("wecho", [](const std::wstring& text) { return text; });
+    database.register_function("u16len", [](std::u16string_view text) { return int64_t(text.size()); });
+    database.register_function("u16echo", [](const std::u16string& text) { return text; });
+
+    const int64_t wide_units = sizeof(wchar_t) == sizeof(char16_t) ? 6 : 5;
+    check(select_one<int64_t>(database, "SELECT wlen('abcd')") == 4, "functions: std::wstring argument length");
+    check(select_one<int64_t>(database, "SELECT wlen('h\u00e9ll\U0001F600')") == wide_units, "functions: std::wstring argument outside the BMP");
+    check(select_one<int64_t>(database, "SELECT u16len('h\u00e9ll\U0001F600')") == 6, "functions: std::u16string_view argument length");
+    check(select_one<int64_t>(database, "SELECT wecho('h\u00e9ll\U0001F600') = 'h\u00e9ll\U0001F600'"), "functions: std::wstring round trip");
+    check(select_one<int64_t>(database, "SELECT u16echo('h\u00e9ll\U0001F600') = 'h\u00e9ll\U0001F600'"), "functions: std::u16string round trip");
+    check(select_one<std::wstring>(database, "SELECT wecho('a\U0001F600')") == L"a\U0001F600", "functions: std::wstring result read back");
+
+    sql::query bound = database.build_query("SELECT length(?1), ?1");
+    bound.arg(std::wstring(L"a\U0001F600"));
+    int64_t length = 0;
+    std::wstring text;
+    if(bound.fetchRow())
+      bound.getField(length).getField(text);
+    check(length == 2 && text == L"a\U0001F600", "query: std::wstring bound and read back");
+  }
+
+  struct item
+  {
+    int64_t group;
+    int64_t id;
+    std::string name;
+  };
+
+  // lookups on a key that repeats values return every match, quoted column names survive the schema
+  // and text constraints under another collation are left to SQLite
+  void check_virtual_table_keys(void)
+  {
+    std::vector<item> items;
+    for(int pos = 0; pos < 100; ++pos)
+      items.push_back({ pos % 10, pos, "n" + std::to_string(pos) });
+
+    sql::db database;
+    database.open(":memory:");
+    sql::virtual_table<item> table(items, { "grp", "id", "na\"me" }, { 0 }, { 1 });
+    check(table.attach(database, "items"), "virtual_table: attach with a quote in a column name");
+    database.execute("CREATE TABLE groups(value INTEGER); INSERT INTO groups VALUES(1), (2)");
+
+    check(select_one<int64_t>(database, "SELECT count(*) FROM items WHERE grp = 3") == 10, "virtual_table: equality on a repeated key");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM items WHERE grp IN (3, 4)") == 20, "virtual_table: IN on a repeated key");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM groups JOIN items ON items.grp = groups.value") == 20, "virtual_table: join on a repeated key");
+    check(select_one<std::string>(database, "SELECT \"na\"\"me\" FROM items WHERE id = 42") == "n42", "virtual_table: lookup on a unique key");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM items WHERE grp BETWEEN 2 AND 4") == 30, "virtual_table: range on a repeated key");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM items WHERE id > 89.5 AND id <= 95") == 6, "virtual_table: fractional range on an integer key");
+    std::string plan;
+    for(auto [id, parent, unused, detail] : database.build_query("EXPLAIN QUERY PLAN SELECT * FROM items WHERE grp = 3").rows<int64_t, int64_t, int64_t, std::string>())
+      plan += detail;
+    check(plan.find("VIRTUAL TABLE INDEX") != std::string::npos && plan.find("INDEX 0:") == std::string::npos,
+          "virtual_table: equality is pushed down to the key index");
+
+    std::vector<item> names { { 0, 0, "abc" }, { 0, 1, "ABC" }, { 0, 2, "b" } };
+    sql::virtual_table<item> named(names, { "grp", "id", "name" }, { 2 });
+    check(named.attach(database, "names"), "virtual_table: attach a text key");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM names WHERE name = 'abc'") == 1, "virtual_table: equality on a text key");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM names WHERE name = 'abc' COLLATE NOCASE") == 2, "virtual_table: NOCASE equality on a text key");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM names WHERE name > 'ab' COLLATE NOCASE") == 3, "virtual_table: NOCASE range on a text key");
+  }
+
+  // the binary format keeps every value and type, and refuses input that isn't a whole stream
+  void check_binary_round_trip(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    database.execute("CREATE TABLE source(id INTEGER, value); CREATE TABLE target(id INTEGER, value);"
+                     "INSERT INTO source VALUES(1, -9223372036854775808), (2, 9223372036854775807), (3, -0.5), (4, 'text'),"
+                     "(5, X'00ff'), (6, X''), (7, ''), (8, NULL)");
+
+    std::stringstream stream;
+    sql::query source = database.build_query("SELECT * FROM source");
+    check(sql::export_stream(source, sql::ostream_sink(stream)) == 8, "binary: every row exported");
+    std::string bytes = stream.str();
+    check(sql::import_stream(database, sql::istream_source(stream), "target") == 8, "binary: every row imported");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM (SELECT id, typeof(value), value FROM source"
+                                        " EXCEPT SELECT id, typeof(value), value FROM target)") == 0, "binary: values keep their types");
+
+    for(std::string input : { bytes.substr(0, bytes.size() - 1), std::string("not a row stream") })
+    {
+      std::istringstream in(input);
+      bool thrown = false;
+      try { sql::import_stream(database, sql::istream_source(in), "target"); }
+      catch(const std::string&) { thrown = true; }
+      check(thrown, "binary: truncated or foreign input throws");
+    }
+    check(select_one<int64_t>(database, "SELECT count(*) FROM target") == 8, "binary: a failed import rolls back its chunk");
+  }
+
+  // values keep their types through a csv export and import, even in columns without affinity
+  void check_csv_round_trip(void)
+  {
+    sql::db database;
+    database.open(":memory:");
+    database.execute("CREATE TABLE source(id INTEGER, value); CREATE TABLE target(id INTEGER, value);"
+                     "INSERT INTO source VALUES(1, 42), (2, '42'), (3, 1.0), (4, 2.5), (5, X'00ff'), (6, X''),"
+                     "(7, 'X''00'''), (8, NULL), (9, ''), (10, '007'), (11, 'a,\"b\"')");
+
+    sql::stream_options options;
+    options.format = sql::stream_format::csv;
+    std::stringstream csv;
+    sql::query source = database.build_query("SELECT * FROM source");
+    sql::export_stream(source, sql::ostream_sink(csv), options);
+    sql::import_stream(database, sql::istream_source(csv), "target", options);
+
+    check(select_one<int64_t>(database, "SELECT count(*) FROM target") == 11, "csv: every row imported");
+    check(select_one<int64_t>(database, "SELECT count(*) FROM (SELECT id, typeof(value), value FROM source"
+                                        " EXCEPT SELECT id, typeof(value), value FROM target)") == 0, "csv: values keep their types");
+
+    // quotes, escapes and CRLF split across reads of a few bytes, and fields longer than the buffer
+    std::string long_text(200, 'x');
+    std::string input = "id,value\r\n1,\"a \"\"quoted\"\" line,\r\nand more\"\r\n2," + long_text + "\r\n3,\"\"\r\n\r\n4,\r\n";
+    std::size_t offset = 0;
+    auto trickle = [&](std::span<std::byte> buffer)
+    {
+      std::size_t size = std::min({ buffer.size(), input.size() - offset, std::size_t(3) });
+      std::memcpy(buffer.data(), input.data() + offset, size);
+      offset += size;
+      return size;
+    };
+    database.execute("CREATE TABLE lines(id INTEGER, value)");
+    options.buffer_size = 0;
+    check(sql::import_stream(database, trickle, "lines", options) == 4, "csv: rows split across reads");
+    check(select_one<std::string>(database, "SELECT value FROM lines WHERE id = 1") == "a \"quoted\" line,\r\nand more", "csv: quoted field split across reads");
+    check(select_one<std::string>(database, "SELECT value FROM lines WHERE id = 2") == long_text, "csv: field longer than the buffer");
+    check(select_one<std::string>(database, "SELECT typeof(value) FROM lines WHERE id = 3") == "text" &&
+          select_one<std::string>(database, "SELECT typeof(value) FROM lines WHERE id = 4") == "null", "csv: quoted empty text and NULL");
+  }
+
+  // keys land on one shard each, fan-out queries see every shard once and merge in order
+  void check_sharded_gather(void)
+  {
+    std::vector<scratch_file> files;
+    files.reserve(3); // a scratch_file copied on growth would remove the file early
+    std::vector<std::string> paths;
+    for(const char* name : { "simple_sqlite_check_shard0.db", "simple_sqlite_check_shard1.db", "simple_sqlite_check_shard2.db" })
+      paths.push_back(files.emplace_back(name).path);
+
+    sql::sharded_db shards;
+    check(shards.open(paths) && shards.size() == 3, "sharded_db: open");
+    check(shards.execute("CREATE TABLE kv(key INTEGER PRIMARY KEY, value TEXT)"), "sharded_db: execute on every shard");
+    check(!shards.execute("INSERT INTO missing VALUES(1)") && shards.lastError() != SQLITE_OK, "sharded_db: a failing shard is reported");
+
+    for(int64_t key = 0; key < 300; ++key)
+      shards.build_query(key, "INSERT INTO kv VALUES(?, ?)").arg(key).arg(std::to_string(key)).execute();
+
+    bool routed = true;
+    for(int64_t key = 0; key < 300; key += 7)
+      routed &= select_one<int64_t>(shards.shard(shards.shardOf(key)), ("SELECT count(*) FROM kv WHERE key = " + std::to_string(key)).c_str()) == 1;
+    check(routed, "sharded_db: a key is stored on the shard it routes to");
+
+    std::vector<std::atomic<int>> visits(shards.size());
+    shards.parallel([&visits](sql::db& shard, std::size_t index) { visits[index] += select_one<int64_t>(shard, "SELECT count(*) FROM kv") > 0; });
+    check(std::all_of(visits.begin(), visits.end(), [](const std::atomic<int>& count) { return count == 1; }), "sharded_db: parallel visits every shard once");
+
+    bool thrown = false;
+    try { shards.parallel([](sql::db&, std::size_t index) { if(index == 1) throw std::string("shard 1"); }); }
+    catch(const std::string& what) { thrown = what == "shard 1"; }
+    check(thrown, "sharded_db: parallel rethrows a shard's exception");
+
+    check(shards.gather<int64_t>("SELECT key FROM kv WHERE key >= ?", int64_t(100)).size() == 200, "sharded_db: gather with arguments");
+    std::vector<int64_t> top = shards.gatherSorted<int64_t>("SELECT key FROM kv ORDER BY key DESC LIMIT 5", 5, std::greater<>());
+    check(top == std::vector<int64_t> { 299, 298, 297, 296, 295 }, "sharded_db: gatherSorted merges and cuts at the limit");
+    shards.close();
+  }
+
+  // routing a key on a set without open shards fails instead of indexing past the end
+  void check_sharded_closed(void)
+  {
+    sql::sharded_db shards;
+    check(shards.shardOf(int64_t(42)) == shards.size(), "sharded_db: shardOf on an unopened set");
+
+    bool thrown = false;
+    try { shards.shardFor(int64_t(42)); }
+    catch(const std::string&) { thrown = true; }
+    check(thrown && shards.lastError() == SQLITE_MISUSE, "sharded_db: shardFor on an unopened set");
+  }
+}
+
+int main(void)
+{
+  check_allocator();
+  check_statement_cache();
+  check_execute_batch();
+  check_field_views();
+  check_typed_rows();
+  check_pool();
+  check_async_writer_stop();
+  check_async_writer_linger();
+  check_fetch_batch();
+  check_blob_stream();
+  check_blob_mixed_io();
+  check_profiling();
+  check_backup();
+  check_checkpointer();
+  check_busy_policy();
+  check_deadline();
+  check_functions();
+#ifdef SQLITE_ENABLE_SESSION
+  check_session();
+#endif
+  check_function_strings();
+  check_virtual_table_keys();
+  check_binary_round_trip();
+  check_csv_round_trip();
+  check_sharded_gather();
+  check_sharded_closed();
+
+  if(failures == 0)
+    std::puts("all checks passed");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}